@@ -1,56 +1,242 @@
 #include "allocator.hpp"
-#include "clean_windows_h.hpp"
 
-////// Platform specific code
+//// get_thread_index
+// leaked, so that threads which exit during static destruction (eg. workers of a global Threadpool) can still return their index
+struct ThreadIndexState {
+	std::mutex				mutex;
+	std_vector<uint32_t>	free_indices;
+	uint32_t				next_index = 0;
+};
+static ThreadIndexState& thread_index_state () {
+	static auto* state = new ThreadIndexState();
+	return *state;
+}
+
+struct ThreadIndex {
+	uint32_t idx;
 
-uint32_t get_os_page_size () {
-	SYSTEM_INFO info;
-	GetSystemInfo(&info);
+	ThreadIndex () {
+		auto& s = thread_index_state();
+		std::lock_guard lock(s.mutex);
+		if (!s.free_indices.empty()) {
+			idx = s.free_indices.back();
+			s.free_indices.pop_back();
+		} else {
+			idx = s.next_index++;
+		}
+	}
+	~ThreadIndex () {
+		auto& s = thread_index_state();
+		std::lock_guard lock(s.mutex);
+		s.free_indices.push_back(idx);
+	}
+};
 
-	return (uint32_t)info.dwPageSize;
+uint32_t get_thread_index () {
+	static thread_local ThreadIndex index;
+	return index.idx;
 }
 
-//// VirtualAlloc
-void* reserve_address_space (size_t size) {
-	ALLOCATOR_PROFILE_SCOPED("reserve_address_space");
+////// Platform specific code
+#if defined(_WIN32)
+	#include "clean_windows_h.hpp"
 
-	void* baseptr = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
-	assert(baseptr != nullptr);
-	return baseptr;
-}
+	uint32_t get_os_page_size () {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
 
-void release_address_space (void* baseptr, size_t size) {
-	ALLOCATOR_PROFILE_SCOPED("release_address_space");
+		return (uint32_t)info.dwPageSize;
+	}
+	size_t get_os_large_page_size () {
+		size_t size = GetLargePageMinimum();
+		return size ? size : 2 * 1024 * 1024; // 0 if large pages are not supported
+	}
 
-	auto ret = VirtualFree(baseptr, 0, MEM_RELEASE);
-	assert(ret != 0);
-}
+	//// VirtualAlloc
+	// MEM_LARGE_PAGES requires MEM_RESERVE|MEM_COMMIT in one call (plus SeLockMemoryPrivilege), which is the opposite of what we want here
+	// so large_pages does not actually request large pages, but the allocators still commit in os_large_page_size steps
+	// which are rounded to absolute addresses, so the region still has to be aligned to os_large_page_size like on linux
+	// (VirtualAlloc only aligns to the 64KB allocation granularity)
+	void* reserve_address_space (size_t size, bool large_pages) {
+		ALLOCATOR_PROFILE_SCOPED("reserve_address_space");
 
-void commit_pages (void* ptr, size_t size) {
-	ALLOCATOR_PROFILE_SCOPED("commit_pages");
+		if (!large_pages) {
+			void* baseptr = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+			assert(baseptr != nullptr);
+			return baseptr;
+		}
 
-	auto ret = VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
-	assert(ret != NULL);
-}
+		// over-reserve and use the aligned part, parts of a reservation can't be released on windows, so the unaligned head and tail simply stay reserved
+		// release_address_space finds the real allocation base via VirtualQuery
+		size_t align = os_large_page_size;
 
-void decommit_pages (void* ptr, size_t size) {
-	ALLOCATOR_PROFILE_SCOPED("decommit_pages");
+		char* rawptr = (char*)VirtualAlloc(NULL, size + align, MEM_RESERVE, PAGE_NOACCESS);
+		assert(rawptr != nullptr);
+		if (!rawptr)
+			return nullptr;
 
-	auto ret = VirtualFree(ptr, size, MEM_DECOMMIT);
-	assert(ret != 0);
-}
+		return (char*)(((uintptr_t)rawptr + (align-1)) & ~(align-1));
+	}
 
-//// AllocatorBitset
-uint32_t _bsf_1 (uint64_t val) {
-	unsigned long idx;
-	auto ret = _BitScanForward64(&idx, val);
-	assert(ret);
-	return idx;
-}
-uint32_t _bsr_0 (uint64_t val) {
-	unsigned long idx;
-	auto ret = _BitScanReverse64(&idx, ~val);
-	assert(ret);
-	return idx;
-}
+	void release_address_space (void* baseptr, size_t size) {
+		ALLOCATOR_PROFILE_SCOPED("release_address_space");
+
+		// baseptr might be the aligned pointer inside a larger reservation (see reserve_address_space)
+		MEMORY_BASIC_INFORMATION info;
+		auto size_ret = VirtualQuery(baseptr, &info, sizeof(info));
+		assert(size_ret != 0);
+
+		auto ret = VirtualFree(info.AllocationBase, 0, MEM_RELEASE);
+		assert(ret != 0);
+	}
+
+	void commit_pages (void* ptr, size_t size) {
+		ALLOCATOR_PROFILE_SCOPED("commit_pages");
+
+		auto ret = VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
+		assert(ret != NULL);
+	}
+
+	void decommit_pages (void* ptr, size_t size) {
+		ALLOCATOR_PROFILE_SCOPED("decommit_pages");
+
+		auto ret = VirtualFree(ptr, size, MEM_DECOMMIT);
+		assert(ret != 0);
+	}
+
+	size_t count_large_pages (void* ptr, size_t size) {
+		return 0;
+	}
+
+	//// AllocatorBitset
+	uint32_t _bsf_1 (uint64_t val) {
+		unsigned long idx;
+		auto ret = _BitScanForward64(&idx, val);
+		assert(ret);
+		return idx;
+	}
+	uint32_t _bsr_0 (uint64_t val) {
+		unsigned long idx;
+		auto ret = _BitScanReverse64(&idx, ~val);
+		assert(ret);
+		return idx;
+	}
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+	#include "stdio.h"
+
+	uint32_t get_os_page_size () {
+		return (uint32_t)sysconf(_SC_PAGESIZE);
+	}
+	size_t get_os_large_page_size () {
+		size_t size = 0;
+
+		FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+		if (f) {
+			if (fscanf(f, "%zu", &size) != 1)
+				size = 0;
+			fclose(f);
+		}
+		return size ? size : 2 * 1024 * 1024;
+	}
+
+	//// mmap
+	// reserve is an inaccessible mapping that does not count towards the commit charge (MAP_NORESERVE)
+	// commit simply makes the pages accessible, the kernel backs them with zeroed physical pages on first touch, just like VirtualAlloc
+	// large_pages uses transparent huge pages instead of MAP_HUGETLB, since MAP_HUGETLB needs a preallocated hugetlbfs pool and commits everything up front
+	void* reserve_address_space (size_t size, bool large_pages) {
+		ALLOCATOR_PROFILE_SCOPED("reserve_address_space");
+
+		if (!large_pages) {
+			void* baseptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			assert(baseptr != MAP_FAILED);
+			return baseptr != MAP_FAILED ? baseptr : nullptr;
+		}
+
+		// huge pages need to be aligned to the huge page size, so over-reserve and trim the unaligned head and tail
+		size_t align = os_large_page_size;
+
+		char* rawptr = (char*)mmap(NULL, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		assert(rawptr != MAP_FAILED);
+		if (rawptr == MAP_FAILED)
+			return nullptr;
+
+		char* baseptr = (char*)(((uintptr_t)rawptr + (align-1)) & ~(align-1));
+		char* endptr = rawptr + size + align;
+
+		if (baseptr > rawptr)
+			munmap(rawptr, baseptr - rawptr);
+		if (endptr > baseptr + size)
+			munmap(baseptr + size, endptr - (baseptr + size));
+
+		// fails if the kernel was built without THP, in that case we simply get normal 4KB pages
+		// (the allocators still commit in os_large_page_size steps, which is harmless)
+		madvise(baseptr, size, MADV_HUGEPAGE);
+		return baseptr;
+	}
+
+	void release_address_space (void* baseptr, size_t size) {
+		ALLOCATOR_PROFILE_SCOPED("release_address_space");
+
+		auto ret = munmap(baseptr, size);
+		assert(ret == 0);
+	}
+
+	void commit_pages (void* ptr, size_t size) {
+		ALLOCATOR_PROFILE_SCOPED("commit_pages");
+
+		auto ret = mprotect(ptr, size, PROT_READ | PROT_WRITE);
+		assert(ret == 0);
+	}
+
+	// MADV_DONTNEED instead of MADV_FREE, because MADV_FREE lets the kernel keep the old contents around until it actually needs the memory,
+	// but BlockAllocator relies on recommitted pages being zero inited like with VirtualAlloc
+	void decommit_pages (void* ptr, size_t size) {
+		ALLOCATOR_PROFILE_SCOPED("decommit_pages");
+
+		auto ret = madvise(ptr, size, MADV_DONTNEED);
+		assert(ret == 0);
+		ret = mprotect(ptr, size, PROT_NONE);
+		assert(ret == 0);
+	}
+
+	// sum AnonHugePages of all mappings overlapping the region (commits split the reserved mapping into multiple)
+	size_t count_large_pages (void* ptr, size_t size) {
+		FILE* f = fopen("/proc/self/smaps", "r");
+		if (!f)
+			return 0;
+
+		uintptr_t begin = (uintptr_t)ptr;
+		uintptr_t end = begin + size;
+
+		size_t huge_kb = 0;
+		bool in_region = false;
+
+		char line[512];
+		while (fgets(line, sizeof(line), f)) {
+			uintptr_t map_begin, map_end;
+			size_t kb;
+
+			if (sscanf(line, "%zx-%zx ", &map_begin, &map_end) == 2) {
+				in_region = map_begin < end && map_end > begin;
+			}
+			else if (in_region && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+				huge_kb += kb;
+			}
+		}
+
+		fclose(f);
+		return huge_kb * 1024 / os_large_page_size;
+	}
 
+	//// AllocatorBitset
+	uint32_t _bsf_1 (uint64_t val) {
+		assert(val != 0);
+		return (uint32_t)__builtin_ctzll(val);
+	}
+	uint32_t _bsr_0 (uint64_t val) {
+		assert(~val != 0);
+		return 63u - (uint32_t)__builtin_clzll(~val);
+	}
+#endif
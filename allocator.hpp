@@ -5,6 +5,11 @@
 #include <vector>
 #include "stl_extensions.hpp"
 #include <stdexcept>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <new>
 
 /*
 	Allocators implemented using OS-level virtual memory
@@ -43,24 +48,37 @@
 #endif
 
 uint32_t get_os_page_size ();
+size_t get_os_large_page_size ();
 
 inline const int os_page_size = get_os_page_size();
+// commit granularity of allocators in large page mode (2MB on x86-64)
+inline const size_t os_large_page_size = get_os_large_page_size();
 
-void* reserve_address_space (size_t size);
+// large_pages: align the reserved region to os_large_page_size and ask the os to back it with transparent huge pages (MADV_HUGEPAGE)
+//  (on windows large pages can only be used when committing everything at reserve time, so there this only aligns the region for the commit granularity of the allocators)
+//  (if the kernel has no THP support the region simply ends up backed by normal pages)
+void* reserve_address_space (size_t size, bool large_pages=false);
 void release_address_space (void* baseptr, size_t size);
 void commit_pages (void* ptr, size_t size);
 void decommit_pages (void* ptr, size_t size);
 
+// how many huge pages are currently backing [ptr, ptr+size), for checking if large_pages actually had an effect
+size_t count_large_pages (void* ptr, size_t size);
+
 // like std::vector but with a reserved (contigous) max size so that no reallocation is ever needed
 class VirtualPushAllocator {
 	char* baseptr; // base address of reserved memory pages
 	char* allocptr; // [top] one past the last allocated item (next ptr to be allocated)
 	char* commitptr; // [baseptr, commitptr) is the commited memory region
 	char* reserveptr; // end of reserved memory, illegal to grow beyond this
+	size_t page_size; // granularity of commits, os_page_size or os_large_page_size
 public:
 
-	inline VirtualPushAllocator (size_t max_size) {
-		baseptr = (char*)reserve_address_space(max_size);
+	inline VirtualPushAllocator (size_t max_size, bool large_pages=false) {
+		page_size = large_pages ? os_large_page_size : os_page_size;
+		max_size = (max_size + (page_size-1)) & ~(page_size-1);
+
+		baseptr = (char*)reserve_address_space(max_size, large_pages);
 		allocptr = baseptr;
 		commitptr = baseptr;
 		reserveptr = baseptr + max_size;
@@ -70,12 +88,23 @@ public:
 		release_address_space(baseptr, reserveptr - baseptr);
 	}
 
+	inline char* base () {
+		return baseptr;
+	}
 	inline char* top () {
 		return allocptr;
 	}
 	inline size_t size () {
 		return allocptr - baseptr;
 	}
+	// how many bytes are commited
+	inline size_t commit_size () {
+		return commitptr - baseptr;
+	}
+	// how many huge pages are backing the commited memory
+	size_t large_page_count () {
+		return count_large_pages(baseptr, commit_size());
+	}
 	
 	// Allocate [size] bytes from the top by 
 	inline char* push (size_t size, size_t align=1) {
@@ -85,31 +114,46 @@ public:
 		ptr = (char*)( ((uintptr_t)ptr + (align-1)) & ~(align-1) );
 
 		// allocate desired [size] bytes
-		ptr += size;
+		char* end = ptr + size;
 
 		// assert on overflow
-		assert(ptr <= reserveptr);
+		assert(end <= reserveptr);
 		
 	#if ALLOCATOR_NULLFAIL == 1
-		if (ptr > reserveptr)
+		if (end > reserveptr)
 			return nullptr;
 	#endif
 
-		if (ptr > commitptr) // at least one page to be committed
-			_grow(ptr);
+		if (end > commitptr) // at least one page to be committed
+			_grow(end);
 
-		DBG_MEMSET(allocptr, DBG_MEMSET_UNINITED, ptr - allocptr);
+		DBG_MEMSET(allocptr, DBG_MEMSET_UNINITED, end - allocptr);
 
+		allocptr = end;
 		return ptr;
 	}
 
+	// Allocate uninitialized memory for [count] items of T
+	template <typename T>
+	inline T* alloc_array (size_t count) {
+		return (T*)push(count * sizeof(T), alignof(T));
+	}
+	// Allocate and construct a T, note that the destructor is never called by the allocator
+	template <typename T, typename... ARGS>
+	inline T* alloc (ARGS&&... args) {
+		void* ptr = push(sizeof(T), alignof(T));
+		if (!ptr) return nullptr;
+		return new (ptr) T (std::forward<ARGS>(args)...);
+	}
+
 	// Reset allocator to a previous top ptr than the current top
-	void reset (char* ptr) {
+	// decommit=false keeps the pages commited, for allocators that will grow to the same size again soon
+	void reset (char* ptr, bool decommit=true) {
 		assert(ptr >= baseptr && ptr <= allocptr);
 
 		DBG_MEMSET(ptr, DBG_MEMSET_FREED, allocptr - ptr);
 
-		if (ptr <= commitptr - os_page_size) // at least 1 page to be decommitted
+		if (decommit && ptr <= commitptr - page_size) // at least 1 page to be decommitted
 			_shrink(ptr);
 
 		allocptr = ptr;
@@ -120,7 +164,8 @@ public:
 		assert(ptr > commitptr);
 		
 		// get new page aligned commit ptr
-		ptr = (char*)( ((uintptr_t)ptr + (os_page_size-1)) & ~(os_page_size-1) );
+		ptr = (char*)( ((uintptr_t)ptr + (page_size-1)) & ~(page_size-1) );
+		ptr = std::min(ptr, reserveptr); // never commit past the reservation
 
 		commit_pages(commitptr, ptr - commitptr);
 		commitptr = ptr;
@@ -131,13 +176,157 @@ public:
 		assert(ptr < commitptr);
 
 		// get new page aligned commit ptr
-		ptr = (char*)( ((uintptr_t)ptr + (os_page_size-1)) & ~(os_page_size-1) );
+		ptr = (char*)( ((uintptr_t)ptr + (page_size-1)) & ~(page_size-1) );
 
 		decommit_pages(ptr, commitptr - ptr);
 		commitptr = ptr;
 	}
 };
 
+// Remembers the top of a VirtualPushAllocator and resets it to that when going out of scope, for scratch allocations
+/* pattern:
+	void mesh_chunk (VirtualPushAllocator& scratch) {
+		ScopedMarker marker(scratch);
+
+		Vertex* verts = scratch.alloc_array<Vertex>(max_verts);
+		...
+	} // everything allocated since marker is freed
+*/
+// pages stay commited by default, since scratch scopes are entered again and again and would otherwise pay for decommit + recommit every time
+// decommit=true gives the memory back to the os when the scope ends, for rare scopes that allocated a lot
+struct ScopedMarker {
+	NO_MOVE_COPY_CLASS(ScopedMarker)
+
+	VirtualPushAllocator&	allocator;
+	char*					marker;
+	bool					decommit;
+
+	ScopedMarker (VirtualPushAllocator& allocator, bool decommit=false): allocator{allocator}, marker{allocator.top()}, decommit{decommit} {}
+	~ScopedMarker () {
+		allocator.reset(marker, decommit);
+	}
+};
+
+// std compatible allocator that allocates from a VirtualPushAllocator, to use std containers for scratch memory
+//  arena_vector<int> vec(&scratch);
+// deallocate only gives the memory back if it was the most recent allocation, so reserve() up front to avoid wasting memory on regrowth
+template <typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+
+	VirtualPushAllocator*	arena;
+
+	ArenaAllocator (VirtualPushAllocator* arena) noexcept: arena{arena} {}
+	template <typename U>
+	ArenaAllocator (ArenaAllocator<U> const& other) noexcept: arena{other.arena} {}
+
+	T* allocate (std::size_t n) {
+		T* ptr = arena->alloc_array<T>(n);
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+	void deallocate (T* ptr, std::size_t n) {
+		if ((char*)(ptr + n) == arena->top())
+			arena->reset((char*)ptr, false); // containers regrow right away, don't decommit
+	}
+};
+template <typename T, typename U>
+inline bool operator == (ArenaAllocator<T> const& a, ArenaAllocator<U> const& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+inline bool operator != (ArenaAllocator<T> const& a, ArenaAllocator<U> const& b) { return a.arena != b.arena; }
+
+template <typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+
+// small index of the calling thread, unique among the running threads, which is reused once a thread exits
+// lets structures keep per-thread data in a plain array instead of a thread_local lookup
+uint32_t get_thread_index ();
+constexpr uint32_t MAX_THREAD_INDEX = 1024; // max number of threads that can be alive at the same time and use get_thread_index()
+
+// Per-thread double buffered arenas for temporary data that has to stay alive until the frame after it was allocated in
+// (eg. job outputs that the main thread consumes one frame later)
+//  frame N:   jobs allocate in arena A
+//  frame N+1: main thread reads from A, jobs allocate in B
+//  frame N+2: A is bulk-reset and reused
+// each thread gets its own pair of arenas on first use of get(), so allocation never needs a lock
+// arenas are only freed with the FrameArenas, but the arenas of an exited thread are reused by the next thread that gets its thread index
+// flip() has to be called at the frame boundary while no thread is allocating
+// memory is poisoned with DBG_MEMSET_FREED on reset in debug builds
+// protect_retired uses a third arena, which is decommited for one frame before being reused, so that any use-after-frame access faults
+class FrameArenas {
+	NO_MOVE_COPY_CLASS(FrameArenas)
+
+	struct ThreadArenas {
+		std::unique_ptr<VirtualPushAllocator>	arenas[3];
+	};
+
+	size_t			arena_size;
+	bool			protect_retired;
+	int				arena_count; // 2 or 3 with protect_retired
+	int				cur = 0; // index of arena to allocate from this frame
+
+	// lookup from get_thread_index() to the arenas of that thread, each entry is only accessed by the thread that currently owns the index
+	std::unique_ptr<ThreadArenas*[]>			table;
+
+	std::mutex		mutex;
+	std_vector<std::unique_ptr<ThreadArenas>>	threads;
+
+	ThreadArenas* _register_thread () {
+		std::lock_guard lock(mutex);
+
+		auto t = std::make_unique<ThreadArenas>();
+		for (int i=0; i<arena_count; ++i)
+			t->arenas[i] = std::make_unique<VirtualPushAllocator>(arena_size);
+
+		threads.emplace_back(std::move(t));
+		return threads.back().get();
+	}
+
+public:
+	// arena_size: max size per arena (only reserved, pages are commited on demand)
+	FrameArenas (size_t arena_size, bool protect_retired=false):
+			arena_size{arena_size}, protect_retired{protect_retired}, arena_count{protect_retired ? 3 : 2},
+			table{std::make_unique<ThreadArenas*[]>(MAX_THREAD_INDEX)} {}
+
+	// get the calling threads arena for the current frame
+	VirtualPushAllocator& get () {
+		uint32_t idx = get_thread_index();
+		assert(idx < MAX_THREAD_INDEX);
+
+		ThreadArenas* arenas = table[idx];
+		if (!arenas)
+			table[idx] = arenas = _register_thread();
+		return *arenas->arenas[cur];
+	}
+
+	// allocate uninitialized memory for count Ts that stays valid until the next flip() after this frame
+	template <typename T>
+	T* alloc_array (size_t count) {
+		return get().alloc_array<T>(count);
+	}
+
+	// start the next frame, the arena that was used two frames ago is reset for reuse
+	void flip () {
+		ALLOCATOR_PROFILE_SCOPED("FrameArenas::flip");
+		std::lock_guard lock(mutex);
+
+		cur = (cur + 1) % arena_count;
+
+		for (auto& t : threads) {
+			if (protect_retired) {
+				// cur was already decommited last frame, the arena of frame N-1 is retired and decommited, so that access faults
+				auto& retired = *t->arenas[(cur + 1) % arena_count];
+				retired.reset(retired.base(), true);
+			} else {
+				// keep the pages commited, since the arena will likely need about the same amount of memory again
+				auto& arena = *t->arenas[cur];
+				arena.reset(arena.base(), false);
+			}
+		}
+	}
+};
+
 // An acceleration structure to speed up finding the first free slot in structures like arrays where items can be freed
 // esentially checks 64 slots at once using tiny uint64_t loops followed by a single bitscan instruction
 // keeps track of the index of the first free and (one past) the index of the last allocated slot which allows growing and shrinking structures to easily know when to resize their memory
@@ -172,8 +361,14 @@ inline uint32_t scan_reverse_allocated (uint64_t* bits, uint32_t start) {
 	return 0;
 }
 
+// summary levels above the bits, summary[0] bit i is set if bits[i] has any free (1) bit, summary[1] bit i if summary[0][i] != 0
+// finding the next free slot then only touches one word per level (plus a short scan of the top level), no matter how fragmented the bits are
+// 2 levels cover 2^18 slots per top level word
+#define ALLOCATOR_BITSET_SUMMARY_LEVELS 2
+
 struct AllocatorBitset {
 	std_vector<uint64_t>	bits;
+	std_vector<uint64_t>	summary[ALLOCATOR_BITSET_SUMMARY_LEVELS];
 	uint32_t				first_free = 0; // index of first free (1) bit in bits, to speed up alloc
 	uint32_t				alloc_end = 0; // index of the free region of 1 bits starting after the last allocated (0) bit, to speed up paging for users
 	
@@ -194,9 +389,12 @@ struct AllocatorBitset {
 		// clear bit
 		assert(bits[idx >> 6] & (1ull << (idx & 63)));
 		bits[idx >> 6] &= ~(1ull << (idx & 63));
+		if (bits[idx >> 6] == 0ull)
+			_summary_clear(idx >> 6);
 
-		// update first_free by scanning to right for next free bit, skips bits before current first_free
-		first_free = scan_forward_free(bits.data(), (uint32_t)bits.size(), first_free >> 6);
+		// update first_free by finding the next word with free bits, skips words before current first_free
+		uint32_t word = _find_free_word(first_free >> 6);
+		first_free = word < (uint32_t)bits.size() ? (word << 6) + _bsf_1(bits[word]) : word << 6;
 
 		// update alloc_end
 		alloc_end = std::max(idx+1, alloc_end);
@@ -206,6 +404,14 @@ struct AllocatorBitset {
 
 	void _grow () {
 		bits.push_back(ONES);
+
+		uint32_t count = (uint32_t)bits.size();
+		for (auto& level : summary) {
+			count = (count + 63) >> 6;
+			if (level.size() < count)
+				level.push_back(0);
+		}
+		_summary_set((uint32_t)bits.size() - 1);
 	}
 
 	// free an allocated (0) bit by setting it to 1
@@ -215,6 +421,7 @@ struct AllocatorBitset {
 
 		// set bit in freeset to 1
 		bits[idx >> 6] |= 1ull << (idx & 63);
+		_summary_set(idx >> 6);
 
 		// only rescan for alloc_end (and potentially shrink bit array) if the last allocated bit was freed
 		if (idx >= alloc_end-1)
@@ -231,8 +438,116 @@ struct AllocatorBitset {
 
 		// shrink bits if there are contiguous zero ints at the end
 		uint32_t needed_bits = ((alloc_end-1) >> 6) + 1; 
-		if (needed_bits < (uint32_t)bits.size())
+		if (needed_bits < (uint32_t)bits.size()) {
 			bits.resize(needed_bits);
+			_summary_shrink();
+		}
+	}
+
+	// word now has free bits, set its bit in all summary levels up to the first one that was already set
+	void _summary_set (uint32_t word) {
+		uint32_t idx = word;
+		for (auto& level : summary) {
+			uint64_t prev = level[idx >> 6];
+			level[idx >> 6] = prev | (1ull << (idx & 63));
+			if (prev != 0ull)
+				break;
+			idx >>= 6;
+		}
+	}
+	// word is now fully allocated, clear its bit in all summary levels up to the first one that still has other bits set
+	void _summary_clear (uint32_t word) {
+		uint32_t idx = word;
+		for (auto& level : summary) {
+			level[idx >> 6] &= ~(1ull << (idx & 63));
+			if (level[idx >> 6] != 0ull)
+				break;
+			idx >>= 6;
+		}
+	}
+	// bits were truncated, truncate the summary levels and recompute their last words
+	void _summary_shrink () {
+		uint32_t count = (uint32_t)bits.size();
+		uint64_t const* below = bits.data();
+
+		for (auto& level : summary) {
+			uint32_t words = (count + 63) >> 6;
+			level.resize(words);
+
+			if (words > 0) {
+				uint64_t last = 0;
+				for (uint32_t i=(words-1) << 6; i<count; ++i) {
+					if (below[i] != 0ull)
+						last |= 1ull << (i & 63);
+				}
+				level[words-1] = last;
+			}
+
+			count = words;
+			below = level.data();
+		}
+	}
+
+	// number of words that can contain allocated bits
+	uint32_t word_count () const {
+		return (alloc_end + 63) >> 6;
+	}
+
+	// call template callback 'void func (uint32_t idx)' for all allocated (0) bits in words [word_begin, word_end) in order
+	// skips free slots a whole word at a time, so sparse arrays are cheap to iterate
+	template <typename FUNC>
+	void for_each_allocated (FUNC func, uint32_t word_begin=0, uint32_t word_end=(uint32_t)-1) const {
+		word_end = std::min(word_end, word_count());
+
+		for (uint32_t i=word_begin; i<word_end; ++i) {
+			uint64_t allocated = ~bits[i]; // bits after alloc_end are always free, no need to mask them
+			while (allocated != 0ull) {
+				func((i << 6) + _bsf_1(allocated));
+				allocated &= allocated - 1; // clear lowest bit
+			}
+		}
+	}
+
+	// get index of first word at or after start which has a free (1) bit
+	// returns bits.size() if there is none
+	uint32_t _find_free_word (uint32_t start) {
+		uint32_t idx = start; // bit index into summary[l]
+		int l = 0;
+
+		// ascend until a summary word has a set bit at or after idx
+		for (;;) {
+			auto& level = summary[l];
+			uint32_t wi = idx >> 6;
+			if (wi >= (uint32_t)level.size())
+				return (uint32_t)bits.size();
+
+			uint64_t w = level[wi] & (ONES << (idx & 63));
+			if (w != 0ull) {
+				idx = (wi << 6) + _bsf_1(w);
+				break;
+			}
+
+			if (l == ALLOCATOR_BITSET_SUMMARY_LEVELS-1) {
+				// top level is scanned linearly
+				do {
+					if (++wi >= (uint32_t)level.size())
+						return (uint32_t)bits.size();
+				} while (level[wi] == 0ull);
+
+				idx = (wi << 6) + _bsf_1(level[wi]);
+				break;
+			}
+
+			idx = wi + 1;
+			l++;
+		}
+
+		// descend, following the lowest set bit
+		while (l > 0) {
+			l--;
+			idx = (idx << 6) + _bsf_1(summary[l][idx]);
+		}
+		return idx;
 	}
 };
 
@@ -242,14 +557,20 @@ struct BlockAllocator {
 	uint32_t	count = 0;
 	uint32_t	max_count;
 	char*		commit_end;
+	size_t		page_size; // granularity of commits, os_page_size or os_large_page_size
+	size_t		reserve_size;
 	AllocatorBitset	slots;
 
-	BlockAllocator (uint32_t max_count): max_count{max_count} {
-		arr = (T*)reserve_address_space(max_count * sizeof(T));
+	// large_pages: commit in os_large_page_size steps and request huge pages to reduce TLB misses for very large arrays
+	BlockAllocator (uint32_t max_count, bool large_pages=false): max_count{max_count} {
+		page_size = large_pages ? os_large_page_size : os_page_size;
+		reserve_size = ((size_t)max_count * sizeof(T) + (page_size-1)) & ~(page_size-1);
+
+		arr = (T*)reserve_address_space(reserve_size, large_pages);
 		commit_end = (char*)arr;
 	}
 	~BlockAllocator () {
-		release_address_space(arr, max_count * sizeof(T));
+		release_address_space(arr, reserve_size);
 	}
 
 	T& operator[] (uint32_t idx) {
@@ -271,7 +592,8 @@ struct BlockAllocator {
 		char* new_end = (char*)&arr[idx +1];
 		if (new_end > commit_end) { // commit pages when needed
 			
-			char* new_commit_ptr = (char*)(((uintptr_t)new_end + os_page_size-1) & ~(os_page_size-1)); // round up needed commit_end
+			char* new_commit_ptr = (char*)(((uintptr_t)new_end + page_size-1) & ~(page_size-1)); // round up needed commit_end
+			new_commit_ptr = std::min(new_commit_ptr, (char*)arr + reserve_size); // never commit past the reservation
 			commit_pages(commit_end, new_commit_ptr - commit_end);
 			commit_end = new_commit_ptr;
 
@@ -291,9 +613,9 @@ struct BlockAllocator {
 		count--;
 
 		char* new_end = (char*)&arr[slots.alloc_end];
-		if (new_end <= commit_end - os_page_size) { // free pages when needed
+		if (new_end <= commit_end - page_size) { // free pages when needed
 
-			char* new_commit_ptr = (char*)(((uintptr_t)new_end + os_page_size-1) & ~(os_page_size-1)); // round up needed commit_end
+			char* new_commit_ptr = (char*)(((uintptr_t)new_end + page_size-1) & ~(page_size-1)); // round up needed commit_end
 			decommit_pages(new_commit_ptr, commit_end - new_commit_ptr);
 			commit_end = new_commit_ptr;
 		}
@@ -301,6 +623,57 @@ struct BlockAllocator {
 		ALLOCATOR_PROFILE_FREE(&arr[idx])
 	}
 
+	// incremental defragmentation: move the items in the highest slots down into the lowest free slots,
+	// so that pages at the top become unused and get decommited by free()
+	// template callback 'void relocate (uint32_t old_idx, uint32_t new_idx, T& item)' is called after each move to let the user patch references to the item
+	// items are moved via move constructor + destructor, so T needs to be move constructible
+	// does at most max_moves moves per call, so it can be called every frame with a small budget
+	// returns the number of bytes that were decommited
+	template <typename RELOCATE>
+	size_t compact (RELOCATE relocate, uint32_t max_moves=64) {
+		ALLOCATOR_PROFILE_SCOPED("BlockAllocator::compact");
+
+		size_t old_commit_size = commit_size();
+
+		for (uint32_t i=0; i<max_moves; ++i) {
+			// no holes left below the last allocated slot
+			if (slots.first_free >= slots.alloc_end)
+				break;
+
+			uint32_t src = slots.alloc_end - 1;
+			uint32_t dst = alloc(); // lowest free slot, always below src so never needs a commit
+			assert(dst < src);
+
+			new (&arr[dst]) T (std::move(arr[src]));
+			arr[src].~T();
+
+			relocate(src, dst, arr[dst]);
+
+			free(src);
+		}
+
+		return old_commit_size - commit_size();
+	}
+
+	// call template callback 'void func (uint32_t idx, T& item)' for all allocated slots in order
+	template <typename FUNC>
+	void for_each (FUNC func) {
+		slots.for_each_allocated([&] (uint32_t idx) {
+			func(idx, arr[idx]);
+		});
+	}
+
+	// like for_each, but splits the slots into ranges of grain_words*64 slots which are iterated in parallel via pool.parallel_for (see Threadpool)
+	// func is called concurrently from multiple threads, and the allocator must not be modified until this returns
+	template <typename POOL, typename FUNC>
+	void parallel_for_each (POOL& pool, FUNC func, uint32_t grain_words=16) {
+		pool.parallel_for(0, slots.word_count(), grain_words, [&] (int64_t begin, int64_t end) {
+			slots.for_each_allocated([&] (uint32_t idx) {
+				func(idx, arr[idx]);
+			}, (uint32_t)begin, (uint32_t)end);
+		});
+	}
+
 	// how many bytes are commited
 	size_t commit_size () const {
 		return commit_end - (char*)arr;
@@ -309,4 +682,488 @@ struct BlockAllocator {
 	float usage () const {
 		return (float)(count * sizeof(T)) / (float)commit_size();
 	}
+	// how many huge pages are backing the commited memory
+	size_t large_page_count () const {
+		return count_large_pages(arr, commit_size());
+	}
+};
+
+// Threadsafe version of AllocatorBitset
+// slots are claimed by CAS on the individual uint64_t words, so threads only contend when they hit the same word
+// bits is allocated for max_count up front, since it can't be resized while other threads are scanning it
+struct ConcurrentAllocatorBitset {
+	static constexpr uint32_t FULL = (uint32_t)-1;
+
+	std::unique_ptr<std::atomic<uint64_t>[]>	bits;
+	uint32_t				word_count;
+	uint64_t				padding_mask; // bits past max_count in the last word, which are permanently marked as allocated (0)
+
+	std::atomic<uint32_t>	first_free = 0; // hint where to start scanning for free (1) bits, can be stale in both directions
+	std::atomic<uint32_t>	alloc_end = 0; // one past the highest allocated slot, only grows (except in recalc_alloc_end)
+
+	ConcurrentAllocatorBitset (uint32_t max_count) {
+		word_count = (uint32_t)(((uint64_t)max_count + 63) >> 6);
+		bits = std::make_unique<std::atomic<uint64_t>[]>(word_count);
+
+		for (uint32_t i=0; i<word_count; ++i)
+			bits[i].store(ONES, std::memory_order_relaxed);
+
+		padding_mask = (max_count & 63) ? ONES << (max_count & 63) : 0;
+		if (padding_mask)
+			bits[word_count-1].store(~padding_mask, std::memory_order_relaxed);
+	}
+
+	bool is_allocated (uint32_t idx) const {
+		return (bits[idx >> 6].load(std::memory_order_relaxed) & (1ull << (idx & 63))) == 0;
+	}
+
+	// finds a free (1) bit and sets it to 0, returns the index of the slot or FULL
+	uint32_t alloc () {
+		uint32_t hint = first_free.load(std::memory_order_relaxed);
+
+		uint32_t idx = _scan_claim_one(hint >> 6);
+		if (idx == FULL && hint > 0) // first_free can be too high if a free() raced with the hint update
+			idx = _scan_claim_one(0);
+		if (idx == FULL)
+			return FULL;
+
+		// move hint past the claimed slot, unless a free() lowered it in the meantime
+		first_free.compare_exchange_strong(hint, idx+1, std::memory_order_relaxed);
+
+		_grow_alloc_end(idx);
+		return idx;
+	}
+
+	// claim up to n free slots at once, with one CAS per word instead of one per slot
+	// returns the number of slots written to out, which is less than n if the bitset is full
+	uint32_t alloc_n (uint32_t* out, uint32_t n) {
+		uint32_t hint = first_free.load(std::memory_order_relaxed);
+
+		uint32_t got = _scan_claim(hint >> 6, out, n);
+		if (got < n && hint > 0) // first_free can be too high if a free() raced with the hint update
+			got += _scan_claim(0, out + got, n - got);
+		if (got == 0)
+			return 0;
+
+		uint32_t max_idx = out[0];
+		for (uint32_t i=1; i<got; ++i)
+			max_idx = std::max(max_idx, out[i]);
+
+		// move hint past the claimed slots, unless a free() lowered it in the meantime
+		first_free.compare_exchange_strong(hint, out[got-1]+1, std::memory_order_relaxed);
+
+		_grow_alloc_end(max_idx);
+		return got;
+	}
+
+	void _grow_alloc_end (uint32_t max_idx) {
+		uint32_t end = alloc_end.load(std::memory_order_relaxed);
+		while (max_idx >= end && !alloc_end.compare_exchange_weak(end, max_idx+1, std::memory_order_relaxed))
+			;
+	}
+
+	// claim the lowest free bit at or after start_word, returns FULL if there is none
+	uint32_t _scan_claim_one (uint32_t start_word) {
+		for (uint32_t i=start_word; i<word_count; ++i) {
+			uint64_t word = bits[i].load(std::memory_order_relaxed);
+
+			while (word != 0ull) {
+				uint64_t take = word & (~word + 1); // lowest free bit
+
+				// acquire pairs with the release in free(), so writes of the previous owner are visible
+				if (bits[i].compare_exchange_weak(word, word & ~take, std::memory_order_acquire, std::memory_order_relaxed))
+					return (i << 6) + _bsf_1(take);
+			}
+		}
+		return FULL;
+	}
+
+	uint32_t _scan_claim (uint32_t start_word, uint32_t* out, uint32_t n) {
+		uint32_t got = 0;
+
+		for (uint32_t i=start_word; i<word_count && got < n; ++i) {
+			uint64_t word = bits[i].load(std::memory_order_relaxed);
+
+			while (word != 0ull && got < n) {
+				// take the lowest free bits, as many as still needed
+				uint64_t take = 0;
+				uint64_t rest = word;
+				for (uint32_t j=got; j<n && rest != 0ull; ++j) {
+					take |= rest & (~rest + 1);
+					rest &= rest - 1;
+				}
+
+				// acquire pairs with the release in free(), so writes of the previous owner are visible
+				if (bits[i].compare_exchange_weak(word, word & ~take, std::memory_order_acquire, std::memory_order_relaxed)) {
+					while (take != 0ull) {
+						out[got++] = (i << 6) + _bsf_1(take);
+						take &= take - 1;
+					}
+				}
+			}
+		}
+		return got;
+	}
+
+	// free an allocated (0) bit by setting it to 1
+	void free (uint32_t idx) {
+		assert(idx < alloc_end.load(std::memory_order_relaxed));
+
+		bits[idx >> 6].fetch_or(1ull << (idx & 63), std::memory_order_release);
+
+		uint32_t hint = first_free.load(std::memory_order_relaxed);
+		while (idx < hint && !first_free.compare_exchange_weak(hint, idx, std::memory_order_relaxed))
+			;
+	}
+
+	// free n slots, slots that share a word are freed with a single atomic
+	void free_n (uint32_t const* idx, uint32_t n) {
+		uint32_t i = 0;
+		while (i < n) {
+			uint32_t word = idx[i] >> 6;
+			uint32_t lowest = idx[i];
+
+			uint64_t mask = 0;
+			for (; i<n && (idx[i] >> 6) == word; ++i) {
+				assert(idx[i] < alloc_end.load(std::memory_order_relaxed));
+				mask |= 1ull << (idx[i] & 63);
+				lowest = std::min(lowest, idx[i]);
+			}
+
+			bits[word].fetch_or(mask, std::memory_order_release);
+
+			uint32_t hint = first_free.load(std::memory_order_relaxed);
+			while (lowest < hint && !first_free.compare_exchange_weak(hint, lowest, std::memory_order_relaxed))
+				;
+		}
+	}
+
+	// rescan for alloc_end, not threadsafe against concurrent alloc()
+	uint32_t recalc_alloc_end () {
+		uint32_t end = alloc_end.load(std::memory_order_relaxed);
+
+		uint32_t i = end > 0 ? (end-1) >> 6 : 0;
+		for (;;) {
+			uint64_t word = bits[i].load(std::memory_order_relaxed);
+			if (i == word_count-1)
+				word |= padding_mask;
+
+			if (word != ONES) {
+				end = (i << 6) + _bsr_0(word) + 1;
+				break;
+			}
+			if (i == 0) {
+				end = 0;
+				break;
+			}
+			--i;
+		}
+
+		alloc_end.store(end, std::memory_order_relaxed);
+		return end;
+	}
+};
+
+// Threadsafe version of BlockAllocator, alloc() and free() can be called from any number of threads
+// pages are committed under a mutex only when commit_end needs to grow
+// free() never decommits, since a concurrent alloc() might be using the pages, call trim() at a point where no thread is allocating instead
+template <typename T>
+struct ConcurrentBlockAllocator {
+	NO_MOVE_COPY_CLASS(ConcurrentBlockAllocator)
+
+	T*			arr;
+	uint32_t	max_count;
+	size_t		page_size; // granularity of commits, os_page_size or os_large_page_size
+	size_t		reserve_size;
+
+	std::atomic<uint32_t>	count = 0;
+	std::atomic<char*>		commit_end;
+	std::mutex				commit_mutex;
+
+	ConcurrentAllocatorBitset	slots;
+
+	ConcurrentBlockAllocator (uint32_t max_count, bool large_pages=false): max_count{max_count}, slots{max_count} {
+		page_size = large_pages ? os_large_page_size : os_page_size;
+		reserve_size = ((size_t)max_count * sizeof(T) + (page_size-1)) & ~(page_size-1);
+
+		arr = (T*)reserve_address_space(reserve_size, large_pages);
+		commit_end.store((char*)arr, std::memory_order_relaxed);
+	}
+	~ConcurrentBlockAllocator () {
+		release_address_space(arr, reserve_size);
+	}
+
+	T& operator[] (uint32_t idx) {
+		return arr[idx];
+	}
+	T const& operator[] (uint32_t idx) const {
+		return arr[idx];
+	}
+
+	uint32_t alloc () {
+		ALLOCATOR_PROFILE_SCOPED("ConcurrentBlockAllocator::alloc");
+
+		uint32_t idx = slots.alloc();
+		if (idx == ConcurrentAllocatorBitset::FULL)
+			throw std::runtime_error("ConcurrentBlockAllocator: max_count reached!");
+
+		count.fetch_add(1, std::memory_order_relaxed);
+
+		char* new_end = (char*)&arr[idx +1];
+		if (new_end > commit_end.load(std::memory_order_acquire))
+			_grow(new_end);
+
+		ALLOCATOR_PROFILE_ALLOC(&arr[idx], sizeof(T))
+		return idx;
+	}
+
+	// allocate up to n slots at once, returns how many were written to out
+	uint32_t alloc_n (uint32_t* out, uint32_t n) {
+		ALLOCATOR_PROFILE_SCOPED("ConcurrentBlockAllocator::alloc_n");
+
+		uint32_t got = slots.alloc_n(out, n);
+		if (got == 0)
+			return 0;
+
+		count.fetch_add(got, std::memory_order_relaxed);
+
+		uint32_t max_idx = out[0];
+		for (uint32_t i=1; i<got; ++i)
+			max_idx = std::max(max_idx, out[i]);
+
+		char* new_end = (char*)&arr[max_idx +1];
+		if (new_end > commit_end.load(std::memory_order_acquire))
+			_grow(new_end);
+
+		return got;
+	}
+
+	void _grow (char* new_end) {
+		std::lock_guard lock(commit_mutex);
+
+		char* end = commit_end.load(std::memory_order_relaxed);
+		if (new_end <= end)
+			return; // another thread already commited the pages
+
+		char* new_commit_ptr = (char*)(((uintptr_t)new_end + page_size-1) & ~(page_size-1)); // round up needed commit_end
+		new_commit_ptr = std::min(new_commit_ptr, (char*)arr + reserve_size); // never commit past the reservation
+		commit_pages(end, new_commit_ptr - end);
+		commit_end.store(new_commit_ptr, std::memory_order_release);
+	}
+
+	void free (uint32_t idx) {
+		ALLOCATOR_PROFILE_SCOPED("ConcurrentBlockAllocator::free");
+
+		assert(slots.is_allocated(idx));
+
+		slots.free(idx);
+		count.fetch_sub(1, std::memory_order_relaxed);
+
+		ALLOCATOR_PROFILE_FREE(&arr[idx])
+	}
+
+	void free_n (uint32_t const* idx, uint32_t n) {
+		ALLOCATOR_PROFILE_SCOPED("ConcurrentBlockAllocator::free_n");
+
+		slots.free_n(idx, n);
+		count.fetch_sub(n, std::memory_order_relaxed);
+	}
+
+	// decommit pages after the last allocated slot
+	// not threadsafe against concurrent alloc(), call at a sync point
+	void trim () {
+		std::lock_guard lock(commit_mutex);
+
+		char* new_end = (char*)&arr[slots.recalc_alloc_end()];
+		char* end = commit_end.load(std::memory_order_relaxed);
+
+		char* new_commit_ptr = (char*)(((uintptr_t)new_end + page_size-1) & ~(page_size-1)); // round up needed commit_end
+		if (new_commit_ptr < end) {
+			decommit_pages(new_commit_ptr, end - new_commit_ptr);
+			commit_end.store(new_commit_ptr, std::memory_order_relaxed);
+		}
+	}
+
+	// how many bytes are commited
+	size_t commit_size () const {
+		return commit_end.load(std::memory_order_relaxed) - (char*)arr;
+	}
+	// ratio of allocated bytes to commited bytes
+	float usage () const {
+		return (float)(count.load(std::memory_order_relaxed) * sizeof(T)) / (float)commit_size();
+	}
+};
+
+// Per-thread front end for ConcurrentBlockAllocator (like the thread caches in tcmalloc)
+// keeps a magazine of up to capacity already claimed slots, so that alloc() and free() usually don't touch the shared bitset at all
+// refills and flushes happen in batches of capacity/2 via alloc_n/free_n
+// one cache per thread (eg. thread_local or a member of your worker), the cache itself is not threadsafe
+// note that slots sitting in a magazine count as allocated for the underlying allocator
+template <typename T>
+struct BlockAllocatorCache {
+	NO_MOVE_COPY_CLASS(BlockAllocatorCache)
+
+	ConcurrentBlockAllocator<T>*	allocator;
+	std::unique_ptr<uint32_t[]>		magazine;
+	uint32_t						capacity;
+	uint32_t						count = 0;
+
+	// stats
+	uint64_t						hits = 0; // alloc/free served from the magazine
+	uint64_t						misses = 0; // alloc/free that had to refill/flush
+
+	BlockAllocatorCache (ConcurrentBlockAllocator<T>* allocator, uint32_t capacity=64):
+			allocator{allocator}, magazine{std::make_unique<uint32_t[]>(capacity)}, capacity{capacity} {
+		assert(capacity >= 2);
+	}
+	~BlockAllocatorCache () {
+		flush(count);
+	}
+
+	T& operator[] (uint32_t idx) {
+		return (*allocator)[idx];
+	}
+
+	uint32_t alloc () {
+		if (count > 0) {
+			hits++;
+		} else {
+			misses++;
+			count = allocator->alloc_n(magazine.get(), capacity / 2);
+			if (count == 0)
+				throw std::runtime_error("BlockAllocatorCache: max_count reached!");
+		}
+		return magazine[--count];
+	}
+
+	void free (uint32_t idx) {
+		assert(allocator->slots.is_allocated(idx));
+
+		if (count < capacity) {
+			hits++;
+		} else {
+			misses++;
+			flush(capacity / 2);
+		}
+		magazine[count++] = idx;
+	}
+
+	// return the oldest n slots in the magazine to the allocator
+	void flush (uint32_t n) {
+		assert(n <= count);
+		if (n == 0) return;
+
+		allocator->free_n(magazine.get(), n);
+
+		count -= n;
+		memmove(&magazine[0], &magazine[n], count * sizeof(uint32_t));
+	}
+
+	// ratio of alloc/free calls that did not touch the shared allocator
+	float hit_rate () const {
+		uint64_t total = hits + misses;
+		return total ? (float)hits / (float)total : 0.0f;
+	}
+};
+
+// Handle to a slot in a GenerationalBlockAllocator, index and generation packed into 64 bits
+// a default constructed handle is null and never valid
+struct SlotHandle {
+	uint32_t	index = 0;
+	uint32_t	generation = 0; // odd while the slot is allocated, 0 for null handles
+
+	bool operator== (SlotHandle const& r) const {
+		return index == r.index && generation == r.generation;
+	}
+	bool operator!= (SlotHandle const& r) const {
+		return !(*this == r);
+	}
+	explicit operator bool () const {
+		return generation != 0;
+	}
+
+	uint64_t packed () const {
+		return ((uint64_t)generation << 32) | index;
+	}
+	static SlotHandle from_packed (uint64_t packed) {
+		return { (uint32_t)packed, (uint32_t)(packed >> 32) };
+	}
+};
+
+// BlockAllocator that hands out SlotHandles instead of raw indices, so that handles to freed slots can be detected in O(1)
+// the generation of a slot is incremented on both alloc and free, so a handle is valid as long as its generation matches
+// generations are stored in their own reserved array (SoA), so validating does not pollute the cache lines of the T array
+// the generation array only ever grows, decommiting it would reset generations to 0 and could make stale handles valid again
+template <typename T>
+struct GenerationalBlockAllocator {
+	NO_MOVE_COPY_CLASS(GenerationalBlockAllocator)
+
+	BlockAllocator<T>	items;
+
+	uint32_t*			generations;
+	uint32_t			generations_count = 0; // number of generations in commited memory
+	size_t				generations_reserve_size;
+
+	GenerationalBlockAllocator (uint32_t max_count, bool large_pages=false): items{max_count, large_pages} {
+		generations_reserve_size = ((size_t)max_count * sizeof(uint32_t) + (os_page_size-1)) & ~((size_t)os_page_size-1);
+		generations = (uint32_t*)reserve_address_space(generations_reserve_size);
+	}
+	~GenerationalBlockAllocator () {
+		release_address_space(generations, generations_reserve_size);
+	}
+
+	// only odd generations are live, so null handles and handles with the generation of a free (or never allocated) slot never match
+	bool is_valid (SlotHandle h) const {
+		return (h.generation & 1) != 0 && h.index < generations_count && generations[h.index] == h.generation;
+	}
+
+	// returns nullptr for stale or null handles
+	T* get (SlotHandle h) {
+		return is_valid(h) ? &items[h.index] : nullptr;
+	}
+	T& operator[] (SlotHandle h) {
+		assert(is_valid(h));
+		return items[h.index];
+	}
+	T const& operator[] (SlotHandle h) const {
+		assert(is_valid(h));
+		return items[h.index];
+	}
+
+	SlotHandle alloc () {
+		uint32_t idx = items.alloc();
+
+		if (idx >= generations_count)
+			_grow(idx);
+
+		uint32_t gen = ++generations[idx];
+		assert(gen & 1);
+		return { idx, gen };
+	}
+
+	void free (SlotHandle h) {
+		assert(is_valid(h));
+
+		generations[h.index]++;
+		items.free(h.index);
+	}
+
+	void _grow (uint32_t idx) {
+		char* commit_end = (char*)&generations[generations_count];
+
+		char* new_end = (char*)&generations[idx +1];
+		char* new_commit_ptr = (char*)(((uintptr_t)new_end + os_page_size-1) & ~((uintptr_t)os_page_size-1)); // round up needed commit_end
+		commit_pages(commit_end, new_commit_ptr - commit_end);
+
+		// Memory is zero inited
+		generations_count = (uint32_t)((new_commit_ptr - (char*)generations) / sizeof(uint32_t));
+	}
+
+	uint32_t count () const {
+		return items.count;
+	}
+	// how many bytes are commited (items and generations)
+	size_t commit_size () const {
+		return items.commit_size() + generations_count * sizeof(uint32_t);
+	}
 };
@@ -0,0 +1,86 @@
+// alloc latency of AllocatorBitset after heavy fragmentation, with the summary levels vs. the old linear scan_forward_free
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/allocator_bitset_fragmentation.cpp allocator.cpp timer.cpp -o allocator_bitset_fragmentation
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/allocator_bitset_fragmentation.cpp allocator.cpp timer.cpp
+// usage: allocator_bitset_fragmentation [slot count in millions, default 16]
+#include "allocator.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <vector>
+#include <algorithm>
+
+// AllocatorBitset alloc/free before the summary levels were added, for comparison
+struct LinearBitset {
+	std_vector<uint64_t>	bits;
+	uint32_t				first_free = 0;
+	uint32_t				alloc_end = 0;
+
+	uint32_t alloc () {
+		uint32_t idx = first_free;
+		if (idx == ((uint32_t)bits.size() << 6))
+			bits.push_back(ONES);
+
+		bits[idx >> 6] &= ~(1ull << (idx & 63));
+		first_free = scan_forward_free(bits.data(), (uint32_t)bits.size(), first_free >> 6);
+		alloc_end = std::max(idx+1, alloc_end);
+		return idx;
+	}
+	void free (uint32_t idx) {
+		bits[idx >> 6] |= 1ull << (idx & 63);
+		first_free = std::min(first_free, idx);
+	}
+};
+
+struct Result {
+	float avg_ns;
+	float p99_ns;
+	float max_ns;
+};
+
+// fill count slots, free every stride-th slot (the holes are far apart, so every alloc has to skip lots of full words), then time refilling the holes
+template <typename BITSET>
+Result bench (uint32_t count, uint32_t stride) {
+	BITSET b;
+	for (uint32_t i=0; i<count; ++i)
+		b.alloc();
+	// free from the back, so the first free slot is only known once all holes exist
+	for (uint32_t i=(count-1) / stride * stride; ; i -= stride) {
+		b.free(i);
+		if (i < stride) break;
+	}
+
+	uint32_t holes = (count-1) / stride + 1;
+	std::vector<float> times(holes);
+
+	for (uint32_t i=0; i<holes; ++i) {
+		auto t = kiss::Timer::start();
+		b.alloc();
+		times[i] = t.end() * 1e9f;
+	}
+
+	float sum = 0;
+	for (float t : times)
+		sum += t;
+	std::sort(times.begin(), times.end());
+
+	return { sum / (float)holes, times[(size_t)(holes * 0.99f)], times.back() };
+}
+
+int main (int argc, char** argv) {
+	uint32_t count = (uint32_t)((argc > 1 ? atoi(argv[1]) : 16) * 1000000);
+
+	printf("%u slots, refilling holes left after freeing every n-th slot, alloc latency in ns (includes ~20ns timer overhead)\n", count);
+	printf("    stride |     linear scan: avg     p99      max |  summary levels: avg     p99      max\n");
+
+	for (uint32_t stride : { 64u, 1024u, 16384u, 262144u, 1u << 22 }) {
+		if (stride > count) break;
+
+		auto lin = bench<LinearBitset>(count, stride);
+		auto sum = bench<AllocatorBitset>(count, stride);
+
+		printf("%10u | %20.0f %7.0f %8.0f | %20.0f %7.0f %8.0f\n", stride,
+			lin.avg_ns, lin.p99_ns, lin.max_ns, sum.avg_ns, sum.p99_ns, sum.max_ns);
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+// Random access throughput of a BlockAllocator array backed by 4KB pages vs. large (2MB) pages
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/allocator_large_pages.cpp allocator.cpp timer.cpp -o allocator_large_pages
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/allocator_large_pages.cpp allocator.cpp timer.cpp
+// usage: allocator_large_pages [array size in MB, default 2048]
+// the array should be much larger than what the TLB can cover with 4KB pages (a few MB) for the difference to show up
+#include "allocator.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+
+static inline uint64_t xorshift64 (uint64_t& state) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static void bench (uint32_t count, bool large_pages) {
+	BlockAllocator<uint64_t> arr(count, large_pages);
+
+	auto fill = kiss::Timer::start();
+	for (uint32_t i=0; i<count; ++i)
+		arr[arr.alloc()] = i;
+	float fill_time = fill.end();
+
+	// dependent random reads, so every access pays the full cache + TLB miss latency
+	constexpr uint64_t READS = 20'000'000;
+	uint64_t rng = 0x9E3779B97F4A7C15ull;
+	uint64_t sum = 0;
+
+	auto read = kiss::Timer::start();
+	for (uint64_t i=0; i<READS; ++i) {
+		uint32_t idx = (uint32_t)((xorshift64(rng) ^ sum) % count);
+		sum += arr[idx];
+	}
+	float read_time = read.end();
+
+	printf("%-11s fill: %7.1f ms  random reads: %6.1f M/s (%5.1f ns each)  huge pages backing the array: %zu / %zu  (checksum %llu)\n",
+		large_pages ? "large pages" : "4KB pages",
+		fill_time * 1000.0f, (float)READS / read_time / 1000000.0f, read_time / (float)READS * 1e9f,
+		arr.large_page_count(), arr.commit_size() / os_large_page_size, (unsigned long long)sum);
+}
+
+int main (int argc, char** argv) {
+	size_t size_mb = argc > 1 ? (size_t)atoll(argv[1]) : 2048;
+	uint32_t count = (uint32_t)(size_mb * 1024 * 1024 / sizeof(uint64_t));
+
+	printf("BlockAllocator<uint64_t> with %u items (%zu MB), large page size: %zu KB\n", count, size_mb, os_large_page_size / 1024);
+
+	bench(count, false);
+	bench(count, true);
+	return 0;
+}
@@ -0,0 +1,113 @@
+// alloc/free throughput of BlockAllocator behind a mutex vs. ConcurrentBlockAllocator vs. ConcurrentBlockAllocator + BlockAllocatorCache
+// for 1..N threads, to check that the concurrent variants scale with the thread count
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/concurrent_block_allocator.cpp allocator.cpp timer.cpp -pthread -o concurrent_block_allocator
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/concurrent_block_allocator.cpp allocator.cpp timer.cpp
+// usage: concurrent_block_allocator [max threads, default 16]
+// note that scaling can only show up to the number of physical cores of the machine
+#include "allocator.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <thread>
+#include <vector>
+#include <mutex>
+
+struct Item {
+	uint64_t data[4];
+};
+
+constexpr uint32_t MAX_COUNT = 1u << 22;
+constexpr int LIVE = 256; // items every thread holds at once
+constexpr int ROUNDS = 4000; // every round allocates and frees LIVE items
+
+struct MutexAllocator {
+	std::mutex m;
+	BlockAllocator<Item> alloc{MAX_COUNT};
+
+	void thread (int tid) {
+		uint32_t idx[LIVE];
+		for (int r=0; r<ROUNDS; ++r) {
+			for (int i=0; i<LIVE; ++i) {
+				std::lock_guard lock(m);
+				idx[i] = alloc.alloc();
+			}
+			for (int i=0; i<LIVE; ++i)
+				alloc[idx[i]].data[0] = (uint64_t)tid;
+			for (int i=0; i<LIVE; ++i) {
+				std::lock_guard lock(m);
+				alloc.free(idx[i]);
+			}
+		}
+	}
+};
+struct Concurrent {
+	ConcurrentBlockAllocator<Item> alloc{MAX_COUNT};
+
+	void thread (int tid) {
+		uint32_t idx[LIVE];
+		for (int r=0; r<ROUNDS; ++r) {
+			for (int i=0; i<LIVE; ++i)
+				idx[i] = alloc.alloc();
+			for (int i=0; i<LIVE; ++i)
+				alloc[idx[i]].data[0] = (uint64_t)tid;
+			for (int i=0; i<LIVE; ++i)
+				alloc.free(idx[i]);
+		}
+	}
+};
+struct ConcurrentCached {
+	ConcurrentBlockAllocator<Item> alloc{MAX_COUNT};
+
+	void thread (int tid) {
+		BlockAllocatorCache<Item> cache(&alloc);
+
+		uint32_t idx[LIVE];
+		for (int r=0; r<ROUNDS; ++r) {
+			for (int i=0; i<LIVE; ++i)
+				idx[i] = cache.alloc();
+			for (int i=0; i<LIVE; ++i)
+				cache[idx[i]].data[0] = (uint64_t)tid;
+			for (int i=0; i<LIVE; ++i)
+				cache.free(idx[i]);
+		}
+	}
+};
+
+// returns million alloc+free pairs per second
+template <typename ALLOC>
+float run (int threads) {
+	ALLOC a;
+
+	auto timer = kiss::Timer::start();
+
+	std::vector<std::thread> t;
+	for (int i=0; i<threads; ++i)
+		t.emplace_back([&a, i] () { a.thread(i); });
+	for (auto& th : t)
+		th.join();
+
+	float time = timer.end();
+	return (float)threads * ROUNDS * LIVE / time / 1000000.0f;
+}
+
+int main (int argc, char** argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+
+	printf("alloc+free pairs per second (M/s), %u hardware threads\n", std::thread::hardware_concurrency());
+	printf("threads |  mutex BlockAllocator | ConcurrentBlockAllocator | + BlockAllocatorCache\n");
+
+	float base_mutex = 0, base_conc = 0, base_cached = 0;
+	for (int threads=1; threads<=max_threads; threads *= 2) {
+		float mutex  = run<MutexAllocator>(threads);
+		float conc   = run<Concurrent>(threads);
+		float cached = run<ConcurrentCached>(threads);
+		if (threads == 1) {
+			base_mutex = mutex; base_conc = conc; base_cached = cached;
+		}
+
+		printf("%7d | %8.2f (%5.2fx)      | %8.2f (%5.2fx)         | %8.2f (%5.2fx)\n", threads,
+			mutex, mutex / base_mutex, conc, conc / base_conc, cached, cached / base_cached);
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+// throughput of SPSCQueue vs. ThreadsafeQueue for one producer and one consumer thread passing std::unique_ptr items
+// single item push/pop_wait and batched push_n/pop_n_wait
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/spsc_queue.cpp timer.cpp -pthread -o spsc_queue
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/spsc_queue.cpp timer.cpp
+// usage: spsc_queue [million items, default 4]
+#include "spsc_queue.hpp"
+#include "threadsafe_queue.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <thread>
+#include <memory>
+#include <vector>
+
+struct Item {
+	uint64_t val;
+};
+typedef std::unique_ptr<Item> ItemPtr;
+
+constexpr size_t BATCH = 64;
+
+// items are allocated up front, so only the queue is measured
+// returns million items per second
+template <typename QUEUE>
+float run (std::vector<ItemPtr>& items, bool batched) {
+	auto q = std::make_unique<QUEUE>();
+	size_t count = items.size();
+	uint64_t sum = 0;
+
+	auto timer = kiss::Timer::start();
+
+	std::thread consumer([&] () {
+		ItemPtr buf[BATCH];
+		size_t got = 0;
+		while (got < count) {
+			if (batched) {
+				size_t n = q->pop_n_wait(buf, 1, BATCH);
+				for (size_t i=0; i<n; ++i)
+					sum += buf[i]->val;
+				got += n;
+			} else {
+				sum += q->pop_wait()->val;
+				got++;
+			}
+		}
+	});
+
+	if (batched) {
+		for (size_t i=0; i<count; i+=BATCH)
+			q->push_n(&items[i], std::min(BATCH, count - i));
+	} else {
+		for (size_t i=0; i<count; ++i)
+			q->push(std::move(items[i]));
+	}
+
+	consumer.join();
+	float time = timer.end();
+
+	if (sum != (uint64_t)count * (count-1) / 2)
+		printf("wrong checksum!\n");
+	return (float)count / time / 1000000.0f;
+}
+
+template <typename QUEUE>
+float bench (size_t count, bool batched) {
+	std::vector<ItemPtr> items(count);
+	for (size_t i=0; i<count; ++i)
+		items[i] = std::make_unique<Item>(Item{ i });
+	return run<QUEUE>(items, batched);
+}
+
+int main (int argc, char** argv) {
+	size_t count = (size_t)(argc > 1 ? atoi(argv[1]) : 4) * 1000000;
+
+	printf("%zu std::unique_ptr items from one producer to one consumer thread, %u hardware threads\n", count, std::thread::hardware_concurrency());
+	printf("                | ThreadsafeQueue M items/s | SPSCQueue M items/s\n");
+
+	float tq = bench<ThreadsafeQueue<ItemPtr>>(count, false);
+	float sq = bench<SPSCQueue<ItemPtr>>(count, false);
+	printf("single item     | %25.2f | %19.2f\n", tq, sq);
+
+	tq = bench<ThreadsafeQueue<ItemPtr>>(count, true);
+	sq = bench<SPSCQueue<ItemPtr>>(count, true);
+	printf("batches of %3zu  | %25.2f | %19.2f\n", BATCH, tq, sq);
+	return 0;
+}
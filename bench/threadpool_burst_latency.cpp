@@ -0,0 +1,88 @@
+// push to execution start latency of jobs pushed in bursts, with and without TPOOL_SPIN_WAIT
+// between bursts the main thread busy waits for a gap, short gaps are where spinning workers should be faster than parked ones
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/threadpool_burst_latency.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp -pthread -o threadpool_burst_latency
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/threadpool_burst_latency.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp
+// usage: threadpool_burst_latency [threads, default hardware_concurrency-1] [jobs per burst, default 16]
+// spinning is disabled on single core machines, so both columns should be the same there
+#include "threadpool.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <vector>
+#include <algorithm>
+
+struct Job {
+	uint64_t pushed;
+	uint64_t latency; // in timestamp ticks
+
+	void execute () {
+		latency = kiss::get_timestamp() - pushed;
+	}
+};
+
+constexpr int BURSTS = 2000;
+
+struct Result {
+	float avg_us;
+	float p50_us;
+	float p99_us;
+};
+
+static void busy_wait (float us) {
+	auto t = kiss::Timer::start();
+	while (t.end() * 1000000.0f < us)
+		;
+}
+
+Result run (int threads, int burst, float gap_us, ThreadpoolFlags flags) {
+	Threadpool<Job> pool(threads, TPRIO_PARALLELISM, "bench", flags);
+
+	std::vector<float> latencies;
+	latencies.reserve((size_t)BURSTS * burst);
+
+	std::vector<std::unique_ptr<Job>> batch(burst);
+
+	for (int b=0; b<BURSTS; ++b) {
+		busy_wait(gap_us);
+
+		uint64_t now = kiss::get_timestamp();
+		for (auto& job : batch) {
+			job = std::make_unique<Job>();
+			job->pushed = now;
+		}
+		pool.push_n(batch.data(), burst);
+
+		int done = 0;
+		while (done < burst) {
+			done += (int)pool.results.pop_n_wait(batch.data() + done, 1, burst - done);
+		}
+		for (auto& job : batch)
+			latencies.push_back((float)job->latency / (float)kiss::timestamp_freq * 1000000.0f);
+	}
+
+	float sum = 0;
+	for (float l : latencies)
+		sum += l;
+	std::sort(latencies.begin(), latencies.end());
+
+	return { sum / (float)latencies.size(), latencies[latencies.size() / 2], latencies[(size_t)(latencies.size() * 0.99f)] };
+}
+
+int main (int argc, char** argv) {
+	int hw = (int)std::thread::hardware_concurrency();
+	int threads = argc > 1 ? atoi(argv[1]) : std::max(hw - 1, 1);
+	int burst = argc > 2 ? atoi(argv[2]) : 16;
+
+	printf("%d threads, %d bursts of %d jobs, latency from push to execute in us, %d hardware threads\n", threads, BURSTS, burst, hw);
+	printf("   gap us |     park: avg    p50    p99 | spin-then-park: avg    p50    p99\n");
+
+	for (float gap : { 0.0f, 10.0f, 50.0f, 200.0f, 1000.0f }) {
+		auto park = run(threads, burst, gap, TPOOL_DEFAULT);
+		auto spin = run(threads, burst, gap, TPOOL_SPIN_WAIT);
+
+		printf("%9.0f | %15.1f %6.1f %6.1f | %19.1f %6.1f %6.1f\n", gap,
+			park.avg_us, park.p50_us, park.p99_us, spin.avg_us, spin.p50_us, spin.p99_us);
+	}
+	return 0;
+}
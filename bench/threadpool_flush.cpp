@@ -0,0 +1,57 @@
+// latency of Threadpool::flush() (cancel + wait_idle + clear results) vs. the old way of flushing by shutting down and restarting all threads
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/threadpool_flush.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp -pthread -o threadpool_flush
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/threadpool_flush.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp
+// usage: threadpool_flush [threads, default 4] [queued jobs per flush, default 100]
+#include "threadpool.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+
+struct Job {
+	uint64_t val;
+
+	void execute () {
+		for (int i=0; i<2000; ++i)
+			val = val * 6364136223846793005ull + 1442695040888963407ull;
+	}
+};
+
+constexpr int FLUSHES = 200;
+
+// returns average flush time in microseconds
+template <typename FLUSH>
+float bench (Threadpool<Job>& pool, int queued, FLUSH flush) {
+	float total = 0;
+	for (int r=0; r<FLUSHES; ++r) {
+		for (int i=0; i<queued; ++i)
+			pool.push(std::make_unique<Job>());
+
+		auto timer = kiss::Timer::start();
+		flush();
+		total += timer.end();
+	}
+	return total / FLUSHES * 1000000.0f;
+}
+
+int main (int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int queued = argc > 2 ? atoi(argv[2]) : 100;
+
+	printf("%d threads, %d jobs queued before every flush, average of %d flushes\n", threads, queued, FLUSHES);
+
+	Threadpool<Job> pool(threads, TPRIO_PARALLELISM, "bench");
+
+	float restart = bench(pool, queued, [&] () {
+		// what flush() used to do
+		pool.shutdown();
+		pool.start_threads(threads, TPRIO_PARALLELISM, "bench");
+	});
+	float flush = bench(pool, queued, [&] () {
+		pool.flush();
+	});
+
+	printf("shutdown + start_threads: %8.1f us\n", restart);
+	printf("flush (cancel + wait_idle): %6.1f us\n", flush);
+	return 0;
+}
@@ -0,0 +1,71 @@
+// jobs/sec of Threadpool with the single shared jobs queue vs. TPOOL_WORK_STEALING for 1..N threads
+// jobs are pushed in batches like a frame would, and results are drained by the calling thread
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/threadpool_jobs_per_sec.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp -pthread -o threadpool_jobs_per_sec
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/threadpool_jobs_per_sec.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp
+// usage: threadpool_jobs_per_sec [max threads, default hardware_concurrency] [work per job in loop iterations, default 100]
+#include "threadpool.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <vector>
+
+static int work_per_job = 100;
+
+struct Job {
+	uint64_t input;
+	uint64_t output;
+
+	void execute () {
+		uint64_t x = input;
+		for (int i=0; i<work_per_job; ++i)
+			x = x * 6364136223846793005ull + 1442695040888963407ull;
+		output = x;
+	}
+};
+
+constexpr int JOBS = 500000;
+constexpr int BATCH = 1000; // jobs pushed at once
+
+float run (int threads, ThreadpoolFlags flags) {
+	Threadpool<Job> pool(threads, TPRIO_PARALLELISM, "bench", flags);
+
+	// allocate up front, only the scheduling is measured
+	std::vector<std::unique_ptr<Job>> jobs(JOBS);
+	for (int i=0; i<JOBS; ++i) {
+		jobs[i] = std::make_unique<Job>();
+		jobs[i]->input = i;
+	}
+
+	std::unique_ptr<Job> results[BATCH];
+	int done = 0;
+
+	auto timer = kiss::Timer::start();
+
+	for (int i=0; i<JOBS; i+=BATCH)
+		pool.push_n(&jobs[i], BATCH);
+	while (done < JOBS)
+		done += (int)pool.results.pop_n_wait(results, 1, BATCH);
+
+	float time = timer.end();
+	return (float)JOBS / time;
+}
+
+int main (int argc, char** argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+	work_per_job = argc > 2 ? atoi(argv[2]) : 100;
+
+	printf("%d jobs in batches of %d, %d iterations of work per job, %u hardware threads\n", JOBS, BATCH, work_per_job, std::thread::hardware_concurrency());
+	printf("threads | shared queue M jobs/s | work stealing M jobs/s\n");
+
+	for (int threads=1; ; threads *= 2) {
+		threads = std::min(threads, max_threads);
+
+		float shared   = run(threads, TPOOL_DEFAULT);
+		float stealing = run(threads, TPOOL_WORK_STEALING);
+		printf("%7d | %21.2f | %22.2f\n", threads, shared / 1000000.0f, stealing / 1000000.0f);
+
+		if (threads == max_threads) break;
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+// memory bandwidth of jobs that stream over their own buffer, with and without TPOOL_NUMA placement
+// with placement every buffer is first touched (and so physically allocated) by a thread of the node its jobs are pushed to with push_to_node
+// without, the main thread touches all buffers and any thread can run any job, like before TPOOL_NUMA existed
+// only makes a difference on machines with more than one numa node (check the printed node list)
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/threadpool_numa.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp -pthread -o threadpool_numa
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/threadpool_numa.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp
+// usage: threadpool_numa [threads, default hardware_concurrency] [MB per buffer, default 32]
+#include "threadpool.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <vector>
+
+struct Job {
+	uint64_t*	data;
+	size_t		count;
+	bool		init; // first touch instead of read
+	uint64_t	sum = 0;
+
+	void execute () {
+		if (init) {
+			for (size_t i=0; i<count; ++i)
+				data[i] = i;
+		} else {
+			uint64_t s = 0;
+			for (size_t i=0; i<count; ++i)
+				s += data[i];
+			sum = s;
+		}
+	}
+};
+
+constexpr int PASSES = 10;
+
+// returns GB/s over all threads
+float run (int threads, size_t buffer_size, bool numa) {
+	ThreadpoolFlags flags = numa ? TPOOL_NUMA | TPOOL_PIN_THREADS : TPOOL_DEFAULT;
+	Threadpool<Job> pool(threads, TPRIO_PARALLELISM, "bench", flags);
+
+	int buffers = threads * 2;
+	size_t count = buffer_size / sizeof(uint64_t);
+
+	// reserve only, pages are physically allocated on first touch
+	std::vector<void*> mem(buffers);
+	for (auto& m : mem) {
+		m = reserve_address_space(buffer_size);
+		commit_pages(m, buffer_size);
+	}
+
+	auto push = [&] (int i, bool init) {
+		auto job = std::make_unique<Job>();
+		job->data = (uint64_t*)mem[i];
+		job->count = count;
+		job->init = init;
+		if (numa)
+			pool.push_to_node(std::move(job), i % pool.numa_node_count());
+		else
+			pool.push(std::move(job));
+	};
+
+	if (numa) {
+		for (int i=0; i<buffers; ++i)
+			push(i, true);
+		pool.wait_idle();
+		pool.results.clear();
+	} else {
+		for (int i=0; i<buffers; ++i) {
+			Job job = { (uint64_t*)mem[i], count, true };
+			job.execute();
+		}
+	}
+
+	auto timer = kiss::Timer::start();
+
+	for (int pass=0; pass<PASSES; ++pass) {
+		for (int i=0; i<buffers; ++i)
+			push(i, false);
+		pool.wait_idle();
+		pool.results.clear();
+	}
+
+	float time = timer.end();
+
+	for (auto& m : mem)
+		release_address_space(m, buffer_size);
+
+	return (float)buffer_size * buffers * PASSES / time / (1024.0f * 1024.0f * 1024.0f);
+}
+
+int main (int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+	size_t buffer_size = (size_t)(argc > 2 ? atoi(argv[2]) : 32) * 1024 * 1024;
+
+	auto& nodes = get_numa_nodes();
+	printf("%zu numa nodes:\n", nodes.size());
+	for (size_t n=0; n<nodes.size(); ++n) {
+		printf("  node %zu: %zu cpus\n", n, nodes[n].size());
+	}
+	printf("%d threads, %d buffers of %zu MB, %d read passes\n", threads, threads*2, buffer_size / (1024*1024), PASSES);
+
+	float plain = run(threads, buffer_size, false);
+	float numa = run(threads, buffer_size, true);
+
+	printf("without placement:              %6.2f GB/s total, %6.2f GB/s per thread\n", plain, plain / threads);
+	printf("TPOOL_NUMA + push_to_node:      %6.2f GB/s total, %6.2f GB/s per thread\n", numa, numa / threads);
+	return 0;
+}
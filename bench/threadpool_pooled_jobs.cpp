@@ -0,0 +1,82 @@
+// cost of heap allocated jobs vs. PooledJob slab allocated jobs in a Threadpool
+// every frame allocates a batch of jobs, pushes them, drains the results and frees them again, so the allocation is part of the measurement
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public bench/threadpool_pooled_jobs.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp -pthread -o threadpool_pooled_jobs
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public bench/threadpool_pooled_jobs.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp
+// usage: threadpool_pooled_jobs [threads, default hardware_concurrency]
+#include "threadpool.hpp"
+#include "timer.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+
+struct HeapJob {
+	uint64_t input[8];
+	uint64_t output;
+
+	void execute () {
+		output = input[0] * 3 + 1;
+	}
+};
+struct PoolJob : PooledJob<PoolJob> {
+	uint64_t input[8];
+	uint64_t output;
+
+	void execute () {
+		output = input[0] * 3 + 1;
+	}
+};
+
+constexpr int FRAMES = 200;
+constexpr int BATCH = 2000;
+
+// returns M jobs per second, including allocation and freeing
+template <typename JOB>
+float run (int threads) {
+	Threadpool<JOB> pool(threads, TPRIO_PARALLELISM, "bench");
+
+	std::unique_ptr<JOB> batch[BATCH];
+	uint64_t sum = 0;
+
+	auto timer = kiss::Timer::start();
+
+	for (int frame=0; frame<FRAMES; ++frame) {
+		for (int i=0; i<BATCH; ++i) {
+			batch[i] = std::make_unique<JOB>();
+			batch[i]->input[0] = i;
+		}
+		pool.push_n(batch, BATCH);
+
+		int done = 0;
+		while (done < BATCH) {
+			size_t n = pool.results.pop_n_wait(batch, 1, BATCH);
+			for (size_t i=0; i<n; ++i) {
+				sum += batch[i]->output;
+				batch[i] = nullptr; // free
+			}
+			done += (int)n;
+		}
+	}
+
+	float time = timer.end();
+
+	if (sum != (uint64_t)FRAMES * (3ull * BATCH * (BATCH-1) / 2 + BATCH))
+		printf("wrong checksum!\n");
+	return (float)FRAMES * BATCH / time / 1000000.0f;
+}
+
+int main (int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+
+	printf("%d threads, %d frames of %d jobs, %zu byte jobs\n", threads, FRAMES, BATCH, sizeof(HeapJob));
+
+	// run both twice, so that the first run does not pay for page faults the second one gets for free
+	run<HeapJob>(threads);
+	run<PoolJob>(threads);
+
+	float heap = run<HeapJob>(threads);
+	float pooled = run<PoolJob>(threads);
+
+	printf("heap (std::make_unique):  %6.2f M jobs/s\n", heap);
+	printf("PooledJob slab:           %6.2f M jobs/s\n", pooled);
+	return 0;
+}
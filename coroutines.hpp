@@ -0,0 +1,303 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <vector>
+#include <atomic>
+#include <type_traits>
+#include <memory>
+#include <iterator>
+#include "assert.h"
+#include "threadsafe_queue.hpp"
+#include "threadpool.hpp"
+
+// C++20 coroutines on top of Threadpool, to write pipelines like  load file -> decode -> continue on main thread  as straight line code
+/* pattern:
+	Task<Mesh> load_mesh (std::string filename) {
+		co_await schedule_on(threadpool); // continue on a threadpool thread
+		auto data = load_file(filename);
+
+		std::vector<Task<Part>> parts;
+		for (auto& p : split(data))
+			parts.push_back(decode_part(p)); // decode_part also does co_await schedule_on(threadpool)
+		auto decoded = co_await when_all(std::move(parts)); // fan out, resumes once all parts are done
+
+		co_await main_thread; // continue on the main thread (inside main_thread.run_pending())
+		co_return upload(decoded);
+	}
+
+	load_mesh("test.obj").detach(); // start without waiting for the result
+	
+	main loop:
+		main_thread.run_pending();
+*/
+// threads are never blocked while waiting, suspended coroutines are simply resumed as tasks once they can continue
+// note that coroutines suspended in a threadpool are lost if it is shut down
+
+template <typename T=void> class Task;
+
+struct _TaskPromiseBase {
+	std::coroutine_handle<>	continuation; // coroutine awaiting us
+	std::exception_ptr		exception;
+	bool					detached = false;
+
+	// tasks are lazy, they only start once awaited or detached
+	std::suspend_always initial_suspend () noexcept { return {}; }
+
+	struct FinalAwaiter {
+		bool await_ready () noexcept { return false; }
+		template <typename PROMISE>
+		std::coroutine_handle<> await_suspend (std::coroutine_handle<PROMISE> h) noexcept {
+			auto& p = h.promise();
+			if (p.continuation)
+				return p.continuation; // resume the awaiting coroutine on this thread (symmetric transfer, does not grow the stack)
+
+			if (p.detached) {
+				if (p.exception)
+					std::terminate(); // like an exception escaping a std::thread
+				h.destroy();
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume () noexcept {}
+	};
+	FinalAwaiter final_suspend () noexcept { return {}; }
+
+	void unhandled_exception () {
+		exception = std::current_exception();
+	}
+};
+
+template <typename T>
+struct _TaskPromise : _TaskPromiseBase {
+	std::optional<T>	value;
+
+	Task<T> get_return_object () noexcept;
+
+	template <typename U>
+	void return_value (U&& val) {
+		value.emplace(std::forward<U>(val));
+	}
+	T result () {
+		if (exception)
+			std::rethrow_exception(exception);
+		return std::move(*value);
+	}
+};
+template <>
+struct _TaskPromise<void> : _TaskPromiseBase {
+	Task<void> get_return_object () noexcept;
+
+	void return_void () {}
+	void result () {
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+};
+
+// coroutine returning T, co_await it from another coroutine to start it and get the result
+// or detach() it to run it without anyone waiting for it
+template <typename T>
+class Task {
+public:
+	typedef _TaskPromise<T> promise_type;
+
+private:
+	std::coroutine_handle<promise_type> h;
+
+public:
+	Task () {}
+	explicit Task (std::coroutine_handle<promise_type> h): h{h} {}
+
+	Task (Task&& r) noexcept: h{r.h} {
+		r.h = nullptr;
+	}
+	Task& operator= (Task&& r) noexcept {
+		if (this != &r) {
+			if (h) h.destroy();
+			h = r.h;
+			r.h = nullptr;
+		}
+		return *this;
+	}
+	Task (Task const&) = delete;
+	Task& operator= (Task const&) = delete;
+
+	~Task () {
+		if (h) h.destroy();
+	}
+
+	bool done () const {
+		return !h || h.done();
+	}
+
+	// start the task and let it free itself once it is finished
+	void detach () {
+		assert(h);
+		auto handle = h;
+		h = nullptr;
+
+		handle.promise().detached = true;
+		handle.resume();
+	}
+
+	auto operator co_await () && noexcept {
+		struct Awaiter {
+			std::coroutine_handle<promise_type> h;
+
+			bool await_ready () noexcept {
+				return h.done();
+			}
+			std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiting) noexcept {
+				h.promise().continuation = awaiting;
+				return h; // start the task on this thread
+			}
+			T await_resume () {
+				return h.promise().result();
+			}
+		};
+		assert(h);
+		return Awaiter{ h };
+	}
+	auto operator co_await () & noexcept {
+		return std::move(*this).operator co_await();
+	}
+};
+
+template <typename T>
+inline Task<T> _TaskPromise<T>::get_return_object () noexcept {
+	return Task<T>{ std::coroutine_handle<_TaskPromise<T>>::from_promise(*this) };
+}
+inline Task<void> _TaskPromise<void>::get_return_object () noexcept {
+	return Task<void>{ std::coroutine_handle<_TaskPromise<void>>::from_promise(*this) };
+}
+
+inline void _resume_coroutine (void* address) {
+	std::coroutine_handle<>::from_address(address).resume();
+}
+
+// co_await schedule_on(pool) to continue the coroutine on one of the threads of pool (Threadpool or anything with post(ThreadpoolTask))
+template <typename POOL>
+auto schedule_on (POOL& pool) {
+	struct Awaiter {
+		POOL& pool;
+
+		bool await_ready () noexcept { return false; }
+		void await_suspend (std::coroutine_handle<> h) {
+			pool.post({ &_resume_coroutine, h.address() });
+		}
+		void await_resume () noexcept {}
+	};
+	return Awaiter{ pool };
+}
+
+// co_await main_thread to continue the coroutine on the main thread
+// the main thread needs to call main_thread.run_pending() regularly (eg. once per frame)
+struct MainThreadScheduler {
+	ThreadsafeQueue<std::coroutine_handle<>>	queue;
+
+	bool await_ready () noexcept { return false; }
+	void await_suspend (std::coroutine_handle<> h) {
+		queue.push(h);
+	}
+	void await_resume () noexcept {}
+
+	// resume the coroutines that are waiting to continue on the main thread
+	// coroutines that co_await main_thread again while being resumed are run next time
+	// returns the number of resumed coroutines
+	size_t run_pending () {
+		size_t count = queue.size();
+		for (size_t i=0; i<count; ++i) {
+			std::coroutine_handle<> h;
+			if (!queue.try_pop(&h))
+				return i;
+			h.resume();
+		}
+		return count;
+	}
+};
+inline MainThreadScheduler main_thread;
+
+//// when_all
+
+// coroutine that starts right away and frees itself once done, used to await the tasks of when_all
+struct _WhenAllItem {
+	struct promise_type {
+		_WhenAllItem get_return_object () noexcept { return {}; }
+		std::suspend_never initial_suspend () noexcept { return {}; }
+		std::suspend_never final_suspend () noexcept { return {}; }
+		void return_void () noexcept {}
+		void unhandled_exception () noexcept { std::terminate(); } // exceptions are caught in _when_all_item
+	};
+};
+
+struct _WhenAllState {
+	std::atomic<size_t>		remaining;
+	std::coroutine_handle<>	continuation;
+
+	std::atomic<bool>		failed = false;
+	std::exception_ptr		exception; // first exception thrown by one of the tasks
+
+	// the last task to finish resumes the awaiting coroutine on its thread
+	void item_done () {
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			continuation.resume();
+	}
+};
+
+template <typename T>
+_WhenAllItem _when_all_item (Task<T>& task, T* result, _WhenAllState* state) {
+	try {
+		if constexpr (std::is_void_v<T>)
+			co_await task;
+		else
+			*result = co_await task;
+	} catch (...) {
+		if (!state->failed.exchange(true, std::memory_order_relaxed))
+			state->exception = std::current_exception();
+	}
+	state->item_done();
+}
+
+template <typename T>
+struct _WhenAllAwaiter {
+	std::vector<Task<T>>&	tasks;
+	T*						results;
+	_WhenAllState			state;
+
+	bool await_ready () noexcept {
+		return tasks.empty();
+	}
+	bool await_suspend (std::coroutine_handle<> h) {
+		state.continuation = h;
+		state.remaining.store(tasks.size() + 1, std::memory_order_relaxed); // +1 so that we don't get resumed before all tasks are started
+
+		for (size_t i=0; i<tasks.size(); ++i) {
+			if constexpr (std::is_void_v<T>)
+				_when_all_item<T>(tasks[i], nullptr, &state);
+			else
+				_when_all_item<T>(tasks[i], &results[i], &state);
+		}
+
+		// if all tasks already finished (did not suspend), continue without suspending
+		return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+	}
+	void await_resume () {
+		if (state.exception)
+			std::rethrow_exception(state.exception);
+	}
+};
+
+// run all tasks concurrently (each one runs until its first suspension, eg. co_await schedule_on(pool), then the next one is started)
+// and resume once all of them are done, returns their results in order (T has to be default constructible)
+// if any task throws, the first exception is rethrown once all tasks are done
+template <typename T>
+Task<std::vector<T>> when_all (std::vector<Task<T>> tasks) {
+	// the tasks write their results concurrently, so they need separate objects (std::vector<bool> packs its elements into shared words and has no data())
+	std::unique_ptr<T[]> results = std::make_unique<T[]>(tasks.size());
+	co_await _WhenAllAwaiter<T>{ tasks, results.get() };
+	co_return std::vector<T>(std::make_move_iterator(results.get()), std::make_move_iterator(results.get() + tasks.size()));
+}
+inline Task<void> when_all (std::vector<Task<void>> tasks) {
+	co_await _WhenAllAwaiter<void>{ tasks, nullptr };
+}
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "stdint.h"
+#include "assert.h"
+#include "stl_extensions.hpp"
+
+// based on http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue (Dmitry Vyukov)
+
+// lock-free bounded multiple producer multiple consumer queue
+// fixed ring of CAPACITY cells, each cell has a sequence number that tells producers and consumers whose turn it is, so there is no lock and no allocation per item
+// alternative to ThreadsafeQueue with mostly the same interface (for example as the results queue of a Threadpool: Threadpool<Job, MPMCQueue<std::unique_ptr<Job>>>)
+// push() waits while the queue is full, so CAPACITY has to be large enough for the maximum number of items that are pushed before the consumer gets to them
+// abort() wakes producers that are waiting in push() and makes them drop their item instead, for when the items are not going to be consumed anymore (eg. Threadpool shutdown)
+// waiting is done via std::atomic::wait (futex on linux, WaitOnAddress on windows), which is only notified if a thread is actually waiting
+template <typename T, size_t CAPACITY=1024>
+class MPMCQueue {
+	static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY-1)) == 0, "CAPACITY needs to be a power of two");
+	static constexpr size_t MASK = CAPACITY - 1;
+
+	struct Cell {
+		std::atomic<size_t>	seq;
+		T					data;
+	};
+	std::unique_ptr<Cell[]>	buf;
+
+	// on separate cache lines, since they are written by producers and consumers respectively
+	alignas(64) std::atomic<size_t>		enqueue_pos = 0;
+	alignas(64) std::atomic<size_t>		dequeue_pos = 0;
+
+	// for blocking waits, incremented on every push/pop, waiters sleep on these with atomic wait
+	alignas(64) std::atomic<uint32_t>	push_count = 0;
+	std::atomic<uint32_t>				pop_waiters = 0;
+	alignas(64) std::atomic<uint32_t>	pop_count = 0;
+	std::atomic<uint32_t>				push_waiters = 0;
+	std::atomic<bool>					aborted = false;
+
+	void _pushed () {
+		push_count.fetch_add(1, std::memory_order_seq_cst);
+		if (pop_waiters.load(std::memory_order_seq_cst) > 0)
+			push_count.notify_all();
+	}
+	void _popped () {
+		pop_count.fetch_add(1, std::memory_order_seq_cst);
+		if (push_waiters.load(std::memory_order_seq_cst) > 0)
+			pop_count.notify_all();
+	}
+
+public:
+	MPMCQueue (): buf{std::make_unique<Cell[]>(CAPACITY)} {
+		for (size_t i=0; i<CAPACITY; ++i)
+			buf[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	static constexpr size_t capacity () {
+		return CAPACITY;
+	}
+	// approximate when there are concurrent pushes or pops
+	size_t size () const {
+		size_t e = enqueue_pos.load(std::memory_order_relaxed);
+		size_t d = dequeue_pos.load(std::memory_order_relaxed);
+		return e > d ? e - d : 0;
+	}
+
+	// push one element if there is space, elem is only moved from on success
+	bool try_push (T& elem) {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;) {
+			cell = &buf[pos & MASK];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false; // full
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->data = std::move(elem);
+		cell->seq.store(pos + 1, std::memory_order_release);
+
+		_pushed();
+		return true;
+	}
+
+	// deque one element from the queue if there is one
+	bool try_pop (T* out) {
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;) {
+			cell = &buf[pos & MASK];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false; // empty
+			} else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		*out = std::move(cell->data);
+		cell->seq.store(pos + MASK + 1, std::memory_order_release);
+
+		_popped();
+		return true;
+	}
+
+	// push one element onto the queue, waits while the queue is full
+	// returns false without pushing (elem is destroyed) if the queue is full and abort() was called
+	bool push (T elem) {
+		for (;;) {
+			if (try_push(elem))
+				return true;
+			if (aborted.load(std::memory_order_seq_cst))
+				return false;
+
+			uint32_t count = pop_count.load(std::memory_order_seq_cst);
+			push_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+			bool pushed = try_push(elem);
+			if (!pushed && !aborted.load(std::memory_order_seq_cst))
+				pop_count.wait(count, std::memory_order_seq_cst);
+
+			push_waiters.fetch_sub(1, std::memory_order_seq_cst);
+			if (pushed)
+				return true;
+		}
+	}
+
+	// push multiple elements onto the queue, waits while the queue is full
+	// returns false if push() was aborted, the element it was aborted on is dropped and the ones after it are not moved from
+	bool push_n (T* elem, size_t count) {
+		for (size_t i=0; i<count; ++i) {
+			if (!push(std::move(elem[i])))
+				return false;
+		}
+		return true;
+	}
+
+	// wake all threads waiting in push() on a full queue and make them (and any later push() on a full queue) return false until reset_abort()
+	void abort () {
+		aborted.store(true, std::memory_order_seq_cst);
+		// changing pop_count makes waiters that loaded it before the abort return from wait
+		pop_count.fetch_add(1, std::memory_order_seq_cst);
+		pop_count.notify_all();
+	}
+	void reset_abort () {
+		aborted.store(false, std::memory_order_seq_cst);
+	}
+
+	// wait to dequeue one element from the queue
+	T pop_wait () {
+		T val;
+		for (;;) {
+			if (try_pop(&val))
+				return val;
+
+			uint32_t count = push_count.load(std::memory_order_seq_cst);
+			pop_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+			bool popped = try_pop(&val);
+			if (!popped)
+				push_count.wait(count, std::memory_order_seq_cst);
+
+			pop_waiters.fetch_sub(1, std::memory_order_seq_cst);
+			if (popped)
+				return val;
+		}
+	}
+
+	// dequeue up to max elements (or none); never waits
+	// writes the elements into their repective indicies in output
+	// returns the number of elements dequeued
+	size_t pop_n (T output[], size_t max) {
+		size_t count = 0;
+		while (count < max && try_pop(&output[count]))
+			count++;
+		return count;
+	}
+
+	// dequeue all elements (including none); never waits
+	// returns the number of elements dequeued
+	size_t pop_all (std_vector<T>* output) {
+		size_t count = 0;
+		T val;
+		while (try_pop(&val)) {
+			output->emplace_back(std::move(val));
+			count++;
+		}
+		return count;
+	}
+
+	// wait until min elements were dequeued, then dequeue up to max elements
+	// returns the number of elements dequeued
+	size_t pop_n_wait (T output[], size_t min, size_t max) {
+		assert(min <= max);
+		size_t count = 0;
+		while (count < min)
+			output[count++] = pop_wait();
+		return count + pop_n(output + count, max - count);
+	}
+
+	void clear () {
+		T val;
+		while (try_pop(&val))
+			;
+	}
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "stdint.h"
+#include "assert.h"
+#include "stl_extensions.hpp"
+
+// bounded single producer single consumer queue, for fixed pipelines like loader thread -> main thread
+// much cheaper than ThreadsafeQueue or MPMCQueue, since there is no lock and no CAS, just one release store per push or pop (or per batch with push_n/pop_n)
+// the producer and consumer each keep a cached copy of the other side's index, so the shared indices are only read when the cached one says the queue is full/empty
+// push() waits while the queue is full and pop_wait() while it is empty, via std::atomic::wait, which is only notified if the other side is actually waiting
+// (pop_n_wait is only notified once min items are available)
+// works with move-only types like std::unique_ptr<JOB>
+// only ever call the push functions from one thread and the pop functions from one other thread
+template <typename T, size_t CAPACITY=1024>
+class SPSCQueue {
+	static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY-1)) == 0, "CAPACITY needs to be a power of two");
+	static constexpr size_t MASK = CAPACITY - 1;
+
+	std::unique_ptr<T[]>	buf;
+
+	// consumer cache line
+	alignas(64) std::atomic<size_t>	head = 0; // next item to be popped
+	size_t							cached_tail = 0;
+	std::atomic<size_t>				consumer_wait_tail = 0; // tail the waiting consumer needs to see before it should be woken, 0 if not waiting
+
+	// producer cache line
+	alignas(64) std::atomic<size_t>	tail = 0; // next slot to be pushed
+	size_t							cached_head = 0;
+	std::atomic<bool>				producer_waiting = false;
+
+	// how many items can be pushed, only reloads head if the cached one says there is not enough space
+	size_t _free_space (size_t t, size_t needed) {
+		if (CAPACITY - (t - cached_head) < needed)
+			cached_head = head.load(std::memory_order_acquire);
+		return CAPACITY - (t - cached_head);
+	}
+	// how many items can be popped, only reloads tail if the cached one says there are not enough items
+	size_t _available (size_t h, size_t needed) {
+		if (cached_tail - h < needed)
+			cached_tail = tail.load(std::memory_order_acquire);
+		return cached_tail - h;
+	}
+
+	// seq_cst store + load of the waiting flag, pairs with the seq_cst flag store + load in the waits, so that either the waiter sees the new index or we see the waiter
+	void _publish_tail (size_t t) {
+		tail.store(t, std::memory_order_seq_cst);
+		// only wake the consumer once enough items for its pop_n_wait are available
+		size_t wait_tail = consumer_wait_tail.load(std::memory_order_seq_cst);
+		if (wait_tail != 0 && t >= wait_tail)
+			tail.notify_one();
+	}
+	void _publish_head (size_t h) {
+		head.store(h, std::memory_order_seq_cst);
+		if (producer_waiting.load(std::memory_order_seq_cst))
+			head.notify_one();
+	}
+
+public:
+	SPSCQueue (): buf{std::make_unique<T[]>(CAPACITY)} {}
+
+	static constexpr size_t capacity () {
+		return CAPACITY;
+	}
+	// approximate when called while the other side is active
+	size_t size () const {
+		return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed);
+	}
+
+	//// Producer
+
+	// push one element if there is space, elem is only moved from on success
+	bool try_push (T& elem) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (_free_space(t, 1) == 0)
+			return false;
+
+		buf[t & MASK] = std::move(elem);
+		_publish_tail(t + 1);
+		return true;
+	}
+
+	// push as many elements as there is space for, with a single publish
+	// returns the number of elements pushed
+	size_t try_push_n (T* elem, size_t count) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		count = std::min(count, _free_space(t, count));
+		if (count == 0)
+			return 0;
+
+		for (size_t i=0; i<count; ++i)
+			buf[(t + i) & MASK] = std::move(elem[i]);
+		_publish_tail(t + count);
+		return count;
+	}
+
+	// push one element, waits while the queue is full
+	void push (T elem) {
+		push_n(&elem, 1);
+	}
+
+	// push count elements, waits while the queue is full
+	void push_n (T* elem, size_t count) {
+		for (;;) {
+			size_t pushed = try_push_n(elem, count);
+			elem += pushed;
+			count -= pushed;
+			if (count == 0)
+				return;
+
+			size_t h = cached_head;
+			producer_waiting.store(true, std::memory_order_seq_cst);
+			head.wait(h, std::memory_order_seq_cst); // returns immediately if the consumer popped in the meantime
+			producer_waiting.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	//// Consumer
+
+	// deque one element from the queue if there is one
+	bool try_pop (T* out) {
+		return pop_n(out, 1) == 1;
+	}
+
+	// dequeue up to max elements (or none) with a single publish; never waits
+	// writes the elements into their repective indicies in output
+	// returns the number of elements dequeued
+	size_t pop_n (T output[], size_t max) {
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t count = std::min(max, _available(h, max));
+		if (count == 0)
+			return 0;
+
+		for (size_t i=0; i<count; ++i)
+			output[i] = std::move(buf[(h + i) & MASK]);
+		_publish_head(h + count);
+		return count;
+	}
+
+	// dequeue all elements (including none); never waits
+	// returns the number of elements dequeued
+	size_t pop_all (std_vector<T>* output) {
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t count = _available(h, CAPACITY);
+		if (count == 0)
+			return 0;
+
+		output->reserve(output->size() + count);
+		for (size_t i=0; i<count; ++i)
+			output->emplace_back( std::move(buf[(h + i) & MASK]) );
+		_publish_head(h + count);
+		return count;
+	}
+
+	// wait until at least min elements are available, then dequeue up to max elements
+	// the consumer is only woken once min elements are available, not on every push
+	// returns the number of elements dequeued
+	size_t pop_n_wait (T output[], size_t min, size_t max) {
+		assert(min <= max && min <= CAPACITY);
+		for (;;) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if (_available(h, min) >= min)
+				return pop_n(output, max);
+
+			size_t t = cached_tail;
+			consumer_wait_tail.store(h + min, std::memory_order_seq_cst);
+			tail.wait(t, std::memory_order_seq_cst); // returns immediately if the producer pushed in the meantime
+			consumer_wait_tail.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// wait to dequeue one element from the queue
+	T pop_wait () {
+		T val;
+		pop_n_wait(&val, 1, 1);
+		return val;
+	}
+};
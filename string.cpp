@@ -2,16 +2,22 @@
 
 #include "assert.h"
 
-#undef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN 1
-#include "windows.h"
+#if defined(_WIN32)
+	#undef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN 1
+	#include "windows.h"
+#endif
 
 namespace kiss {
 	// Printf that appends to a std::string
 	void vprints (std::string* s, char const* format, va_list vl) { // print 
 		size_t old_size = s->size();
 		for (;;) {
-			auto ret = vsnprintf(&(*s)[old_size], s->size() -old_size +1, format, vl); // i think i'm technically not allowed to overwrite the null terminator
+			// vsnprintf consumes the va_list on linux (unlike msvc), so the second call needs a fresh copy
+			va_list vl_copy;
+			va_copy(vl_copy, vl);
+			auto ret = vsnprintf(&(*s)[old_size], s->size() -old_size +1, format, vl_copy); // i think i'm technically not allowed to overwrite the null terminator
+			va_end(vl_copy);
 			ret = ret >= 0 ? ret : 0;
 			bool was_bienough = (size_t)ret < (s->size() -old_size +1);
 			s->resize(old_size +ret);
@@ -44,6 +50,7 @@ namespace kiss {
 		return std::move(ret);
 	}
 
+#if defined(_WIN32)
 	std::basic_string<wchar_t> utf8_to_wchar (std::string_view utf8) {
 
 																	   // overallocate, this might be more performant than having to call MultiByteToWideChar twice
@@ -95,6 +102,7 @@ namespace kiss {
 
 		*/
 	}
+#endif
 
 	std::string_view trim (std::string_view sv) {
 		size_t start=0, end=sv.size();
@@ -0,0 +1,97 @@
+// Threadpool with a results queue that is smaller than the number of jobs pushed
+// workers wait for space in the MPMCQueue before a job counts as done, destruction and flush() have to make them drop their results instead of deadlocking
+// build (from the kisslib root, tracy only needs to be on the include path):
+//  g++ -std=c++20 -O2 -I. -I<tracy>/public tests/threadpool_bounded_results.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp -pthread -o threadpool_bounded_results
+//  cl /std:c++20 /O2 /EHsc /I. /I<tracy>/public tests/threadpool_bounded_results.cpp threadpool.cpp allocator.cpp timer.cpp string.cpp
+// returns 0 on success, fails with exit code 1 instead of hanging if any of the cases deadlocks
+#include "threadpool.hpp"
+#include "mpmc_queue.hpp"
+#include "stdio.h"
+#include "stdlib.h"
+#include <chrono>
+
+struct Job {
+	int val;
+
+	void execute () {
+		val *= 2;
+	}
+};
+
+constexpr int JOBS = 20;
+typedef Threadpool<Job, MPMCQueue<std::unique_ptr<Job>, 4>> Pool;
+
+static int failed = 0;
+#define CHECK(cond) if (!(cond)) { printf("FAILED: %s (line %d)\n", #cond, __LINE__); failed++; }
+
+static void push_jobs (Pool& pool, int count) {
+	for (int i=0; i<count; ++i) {
+		auto job = std::make_unique<Job>();
+		job->val = i;
+		pool.push(std::move(job));
+	}
+}
+
+int main () {
+	std::thread watchdog([] () {
+		std::this_thread::sleep_for(std::chrono::seconds(30));
+		printf("FAILED: deadlock\n");
+		fflush(stdout);
+		_Exit(1);
+	});
+	watchdog.detach();
+
+	{ // destroy the pool while workers wait for space in results
+		Pool pool(2, TPRIO_PARALLELISM, "test");
+		push_jobs(pool, JOBS);
+	}
+	printf("destructor ok\n");
+
+	{ // flush drops the results, after that results work normally again
+		Pool pool(2, TPRIO_PARALLELISM, "test");
+		push_jobs(pool, JOBS);
+		pool.flush();
+
+		std::unique_ptr<Job> res;
+		CHECK(!pool.results.try_pop(&res));
+
+		push_jobs(pool, 3);
+		pool.wait_idle();
+
+		int count = 0;
+		while (pool.results.try_pop(&res))
+			count++;
+		CHECK(count == 3);
+	}
+	printf("flush ok\n");
+
+	{ // wait_idle works as long as another thread consumes the results
+		Pool pool(2, TPRIO_PARALLELISM, "test");
+		push_jobs(pool, JOBS);
+
+		int sum = 0;
+		std::thread consumer([&] () {
+			for (int i=0; i<JOBS; ++i)
+				sum += pool.results.pop_wait()->val;
+		});
+		pool.wait_idle();
+		consumer.join();
+
+		CHECK(sum == JOBS * (JOBS-1));
+	}
+	printf("wait_idle with consumer ok\n");
+
+	{ // shutdown and restart with unconsumed results
+		Pool pool(2, TPRIO_PARALLELISM, "test", TPOOL_WORK_STEALING);
+		push_jobs(pool, JOBS);
+		pool.shutdown();
+		pool.start_threads(2, TPRIO_PARALLELISM, "test");
+
+		push_jobs(pool, 4);
+		pool.wait_idle();
+		CHECK(pool.results.size() == 4);
+	}
+	printf("shutdown + restart ok\n");
+
+	return failed ? 1 : 0;
+}
@@ -70,9 +70,100 @@
 		set_mcss_thread(prio);
 	}
 
-	void set_thread_preferred_core (int preferred_core) {
-		//auto ret = SetThreadIdealProcessor(GetCurrentThread(), preferred_core);
-		//assert(ret >= 0);
+	int get_process_core_count () {
+		DWORD_PTR process_mask, system_mask;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) || process_mask == 0)
+			return (int)std::thread::hardware_concurrency();
+		return std::popcount((uint64_t)process_mask);
+	}
+
+	// mask with only the index-th cpu set that the process is allowed to run on, wraps around like on linux
+	// (only the processor group of the process, like GetProcessAffinityMask)
+	static DWORD_PTR get_allowed_cpu_mask (DWORD_PTR process_mask, int index) {
+		int count = std::popcount((uint64_t)process_mask);
+		if (count <= 0)
+			return 0;
+		index %= count;
+
+		for (int cpu=0; cpu<(int)sizeof(DWORD_PTR)*8; ++cpu) {
+			DWORD_PTR bit = (DWORD_PTR)1 << cpu;
+			if ((process_mask & bit) && index-- == 0)
+				return bit;
+		}
+		return 0;
+	}
+
+	void set_thread_preferred_core (int core_index) {
+		DWORD_PTR process_mask, system_mask;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+			return;
+
+		DWORD_PTR mask = get_allowed_cpu_mask(process_mask, core_index);
+		if (mask != 0)
+			SetThreadAffinityMask(GetCurrentThread(), mask);
+	}
+
+	void set_thread_excluded_core (int core_index) {
+		DWORD_PTR process_mask, system_mask;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+			return;
+
+		DWORD_PTR mask = process_mask;
+		if (core_index >= 0)
+			mask &= ~get_allowed_cpu_mask(process_mask, core_index);
+		if (mask != 0)
+			SetThreadAffinityMask(GetCurrentThread(), mask);
+	}
+
+	std::vector<std::vector<int>> const& get_numa_nodes () {
+		static std::vector<std::vector<int>> nodes = [] () {
+			std::vector<std::vector<int>> nodes;
+
+			DWORD_PTR process_mask, system_mask;
+			if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+				process_mask = (DWORD_PTR)-1;
+
+			ULONG highest = 0;
+			GetNumaHighestNodeNumber(&highest);
+
+			for (ULONG node=0; node<=highest; ++node) {
+				GROUP_AFFINITY affinity;
+				if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || affinity.Group != 0)
+					continue; // cpu indices are only meaningful in processor group 0 for now
+
+				std::vector<int> cpus;
+				for (int cpu=0; cpu<(int)sizeof(KAFFINITY)*8; ++cpu) {
+					if ((affinity.Mask & process_mask) & ((KAFFINITY)1 << cpu))
+						cpus.push_back(cpu);
+				}
+				if (!cpus.empty())
+					nodes.emplace_back(std::move(cpus));
+			}
+
+			if (nodes.empty()) {
+				nodes.emplace_back();
+				for (int cpu=0; cpu<(int)sizeof(DWORD_PTR)*8; ++cpu) {
+					if (process_mask & ((DWORD_PTR)1 << cpu))
+						nodes[0].push_back(cpu);
+				}
+			}
+			return nodes;
+		}();
+		return nodes;
+	}
+
+	void set_thread_numa_node (int node, int core_in_node) {
+		auto& nodes = get_numa_nodes();
+		auto& cpus = nodes[node % nodes.size()];
+
+		DWORD_PTR mask = 0;
+		if (core_in_node >= 0) {
+			mask = (DWORD_PTR)1 << cpus[core_in_node % cpus.size()];
+		} else {
+			for (int cpu : cpus)
+				mask |= (DWORD_PTR)1 << cpu;
+		}
+		SetThreadAffinityMask(GetCurrentThread(), mask);
 	}
 
 	void set_thread_description (std::string_view description) {
@@ -101,4 +192,170 @@
 	} _setWindowsSchedFreq; // set timeBeginPeriod at startup
 #endif
 
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/resource.h>
+	#include <unistd.h>
+	#include <string.h>
+	#include <stdio.h>
+
+	void set_process_priority () {
+		// raising priority (negative nice) requires CAP_SYS_NICE, so like on windows don't do anything for now
+	}
+
+	// linux has no thread priorities for normal (SCHED_OTHER) threads, but nice values are per thread
+	//  (setpriority on a thread id only affects that thread, even though the man page talks about processes)
+	// nice -20 to 19, each step is ~10% cpu time relative to the other threads when the cpu is loaded
+	// background threads use SCHED_IDLE, which only runs them if nothing else wants the core, so they should never steal cycles from other threads
+	//  (if that fails we still get the lowest nice)
+	// negative nice values fail without CAP_SYS_NICE or a matching RLIMIT_NICE, in that case the main thread simply stays at normal priority
+	void set_thread_priority (ThreadPrio prio) {
+		int policy = SCHED_OTHER;
+		int nice = 0;
+		switch (prio) {
+			case TPRIO_MAIN:		nice = -10; break;
+			case TPRIO_PARALLELISM:	nice = -5; break;
+			case TPRIO_BACKGROUND:	policy = SCHED_IDLE; nice = 19; break;
+		}
+
+		sched_param param = {};
+		pthread_setschedparam(pthread_self(), policy, &param);
+
+		setpriority(PRIO_PROCESS, (id_t)gettid(), nice);
+	}
+
+	// cpus this process is allowed to run on (respects taskset and cgroup cpusets)
+	// queried once (at startup or on first use from a global Threadpool), since sched_getaffinity only returns the mask of a thread, which changes once we pin it
+	static cpu_set_t const& get_process_cpus () {
+		static cpu_set_t set = [] () {
+			cpu_set_t set;
+			if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+				CPU_ZERO(&set);
+				for (int cpu=0; cpu<(int)sysconf(_SC_NPROCESSORS_ONLN) && cpu<CPU_SETSIZE; ++cpu)
+					CPU_SET(cpu, &set);
+			}
+			return set;
+		}();
+		return set;
+	}
+	static cpu_set_t const& _process_cpus_at_startup = get_process_cpus();
+
+	int get_process_core_count () {
+		int count = CPU_COUNT(&get_process_cpus());
+		return count > 0 ? count : (int)std::thread::hardware_concurrency();
+	}
+
+	// index-th allowed cpu
+	static int get_allowed_cpu (int index) {
+		cpu_set_t const& allowed = get_process_cpus();
+
+		int count = CPU_COUNT(&allowed);
+		if (count <= 0)
+			return index;
+		index %= count;
+
+		for (int cpu=0; cpu<CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+				return cpu;
+		}
+		return 0;
+	}
+
+	void set_thread_preferred_core (int core_index) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(get_allowed_cpu(core_index), &set);
+
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	void set_thread_excluded_core (int core_index) {
+		cpu_set_t set = get_process_cpus();
+		if (core_index >= 0)
+			CPU_CLR(get_allowed_cpu(core_index), &set);
+		if (CPU_COUNT(&set) > 0)
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	// parse sysfs cpu/node lists like "0-7,16-23"
+	static std::vector<int> parse_sysfs_list (char const* path) {
+		std::vector<int> list;
+
+		FILE* f = fopen(path, "r");
+		if (!f)
+			return list;
+
+		int first, last;
+		while (fscanf(f, "%d", &first) == 1) {
+			last = first;
+			int c = fgetc(f);
+			if (c == '-') {
+				if (fscanf(f, "%d", &last) != 1)
+					break;
+				c = fgetc(f);
+			}
+			for (int i=first; i<=last; ++i)
+				list.push_back(i);
+			if (c != ',')
+				break;
+		}
+
+		fclose(f);
+		return list;
+	}
+
+	std::vector<std::vector<int>> const& get_numa_nodes () {
+		static std::vector<std::vector<int>> nodes = [] () {
+			std::vector<std::vector<int>> nodes;
+
+			for (int node : parse_sysfs_list("/sys/devices/system/node/online")) {
+				char path[64];
+				snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+				std::vector<int> cpus;
+				for (int cpu : parse_sysfs_list(path)) {
+					if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &get_process_cpus()))
+						cpus.push_back(cpu);
+				}
+				if (!cpus.empty())
+					nodes.emplace_back(std::move(cpus));
+			}
+
+			if (nodes.empty()) {
+				nodes.emplace_back();
+				for (int cpu=0; cpu<CPU_SETSIZE; ++cpu) {
+					if (CPU_ISSET(cpu, &get_process_cpus()))
+						nodes[0].push_back(cpu);
+				}
+			}
+			return nodes;
+		}();
+		return nodes;
+	}
+
+	void set_thread_numa_node (int node, int core_in_node) {
+		auto& nodes = get_numa_nodes();
+		auto& cpus = nodes[node % nodes.size()];
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (core_in_node >= 0) {
+			CPU_SET(cpus[core_in_node % cpus.size()], &set);
+		} else {
+			for (int cpu : cpus)
+				CPU_SET(cpu, &set);
+		}
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	void set_thread_description (std::string_view description) {
+		// names are limited to 15 chars + null terminator
+		char name[16];
+		size_t len = std::min(description.size(), sizeof(name)-1);
+		memcpy(name, description.data(), len);
+		name[len] = '\0';
+
+		pthread_setname_np(pthread_self(), name);
+	}
 #endif
@@ -1,8 +1,15 @@
 #pragma once
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <concepts>
+#include <bit>
 #include "macros.hpp"
 #include "threadsafe_queue.hpp"
+#include "work_stealing_deque.hpp"
+#include "allocator.hpp"
 #include "string.hpp"
+#include "timer.hpp"
 
 #ifdef TRACY_ENABLE
 	#include "tracy/Tracy.hpp"
@@ -18,8 +25,33 @@ enum ThreadPrio {
 	TPRIO_BACKGROUND,
 };
 
+enum ThreadpoolFlags {
+	TPOOL_DEFAULT		= 0,
+	// each thread takes jobs from the jobs queue in batches into its own WorkStealingDeque, idle threads steal from the others
+	// reduces contention on the jobs mutex with many small jobs and many threads
+	// note that jobs already taken into a deque are no longer visible to jobs.iterate_queue / remove_if etc. and are not preempted by higher priority jobs
+	TPOOL_WORK_STEALING	= 1,
+	// pin each thread to its own core (wraps around if there are more threads than cores)
+	TPOOL_PIN_THREADS	= 2,
+	// never run threads on core 0, to keep it free for the main thread (which should call set_thread_preferred_core(0))
+	TPOOL_RESERVE_MAIN_CORE = 4,
+	// distribute threads over the numa nodes (see get_numa_nodes) and keep each thread on the cores of its node
+	// together with TPOOL_PIN_THREADS each thread is pinned to one core of its node, TPOOL_RESERVE_MAIN_CORE has no effect
+	// enables push_to_node() for jobs that should run close to their memory
+	TPOOL_NUMA			= 8,
+	// idle threads spin for a bit before going to sleep (see ThreadsafeQueue::set_spin_count), lowers the latency of jobs that are pushed in bursts
+	// costs cpu time while idle, so mainly useful for TPRIO_PARALLELISM pools, change the amount with jobs.set_spin_count()
+	// ignored if the process can only run on a single core (get_process_core_count)
+	TPOOL_SPIN_WAIT		= 16,
+};
+ENUM_BITFLAG_OPERATORS(ThreadpoolFlags)
+
 // std::thread::hardware_concurrency() gets the number of cpu threads
 
+// number of cpu threads the process is allowed to run on, which is less than hardware_concurrency() under taskset, cgroup cpusets or a restricted process affinity mask
+// the core_index of set_thread_preferred_core and set_thread_excluded_core wraps around this count
+int get_process_core_count ();
+
 // Is is probaby reasonable to set a game process priority to above_normal, so that background apps don't interfere with the games performance too much,
 // As long as we don't use 100% of the cpu the background apps should run fine, and we might have less random framedrops from being preempted
 void set_process_priority ();
@@ -30,67 +62,630 @@ void set_process_priority ();
 void set_thread_priority (ThreadPrio prio);
 
 // Set a desired cpu core for the current thread to run on
+// core_index is wrapped around the cores the process is allowed to run on
 void set_thread_preferred_core (int core_index);
 
+// Allow the current thread to run on all cores except core_index (eg. keep core 0 free for the main thread)
+// core_index -1 allows all cores again
+void set_thread_excluded_core (int core_index);
+
+// cpus of each numa node (sockets on multi socket machines), memory is faster to access from the cpus of the node it is allocated on
+// returns a single node with all cpus if the machine is not numa or the topology can't be determined
+// only includes the cpus the process is allowed to run on, nodes without any are left out
+std::vector<std::vector<int>> const& get_numa_nodes ();
+
+// Allow the current thread to only run on the cpus of numa node (index into get_numa_nodes())
+// core_in_node >= 0 pins the thread to one cpu of the node instead (wrapped around the number of cpus in the node)
+void set_thread_numa_node (int node, int core_in_node=-1);
+
 // Set description of current thread (mainly for debugging)
 // allows for easy overview of threads in debugger
 void set_thread_description (std::string_view description);
 
+// type erased function to run on threadpool threads, used to implement parallel_for etc. independently of the JOB type
+struct ThreadpoolTask {
+	void	(*func)(void* data);
+	void*	data;
+};
+
+// cancel queued jobs in O(1) instead of searching the queues with remove_if
+// cancel() invalidates all tokens issued by this source so far, tokens issued afterwards are valid again
+//  (eg. one CancelSource per chunk, cancel() when the chunk gets unloaded or needs to be remeshed)
+// jobs with a 'CancelToken cancel_token' member are dropped by the Threadpool when popped instead of executed if the token was cancelled
+// the source has to outlive the jobs that have its tokens
+class CancelSource;
+struct CancelToken {
+	CancelSource const*	source = nullptr; // null: never cancelled
+	uint32_t			epoch = 0;
+
+	inline bool is_cancelled () const;
+};
+class CancelSource {
+	NO_MOVE_COPY_CLASS(CancelSource)
+	friend struct CancelToken;
+
+	std::atomic<uint32_t>	epoch = 0;
+public:
+	CancelSource () {}
+
+	CancelToken token () const {
+		return { this, epoch.load(std::memory_order_relaxed) };
+	}
+	void cancel () {
+		epoch.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+inline bool CancelToken::is_cancelled () const {
+	return source && source->epoch.load(std::memory_order_relaxed) != epoch;
+}
+
+// snapshot of the counters of a Threadpool, see Threadpool::stats()
+// the counters are always enabled (not just with TRACY_ENABLE), they cost two timestamps and a few uncontended atomic adds per job
+struct ThreadpoolStats {
+	// histograms with log2 buckets in microseconds: bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us, the last bucket includes everything above
+	static constexpr int BUCKETS = 28;
+
+	uint64_t	latency[BUCKETS] = {}; // time from Threadpool::push() to the job starting, only for jobs with a 'uint64_t enqueue_time' member
+	uint64_t	exec_time[BUCKETS] = {}; // time spent in Job.execute()
+
+	uint64_t	jobs_executed = 0;
+	uint64_t	jobs_cancelled = 0; // dropped because their cancel_token was cancelled
+	uint64_t	tasks_run = 0; // parallel_for chunks, graph nodes, coroutines etc.
+	uint64_t	steals = 0; // jobs stolen from other threads with TPOOL_WORK_STEALING
+
+	size_t		jobs_high_water = 0; // max number of jobs in the jobs queue at once
+
+	// summed over the threadpool threads since start_threads() or reset_stats()
+	double		busy_seconds = 0; // running jobs or tasks
+	double		idle_seconds = 0; // waiting for work
+
+	// fraction of time the threads were busy, if this is low the pool has more threads than it needs
+	float utilization () const {
+		double total = busy_seconds + idle_seconds;
+		return total > 0 ? (float)(busy_seconds / total) : 0.0f;
+	}
+
+	static int bucket (uint64_t microseconds) {
+		return std::min((int)std::bit_width(microseconds), BUCKETS-1);
+	}
+	// approximate percentile (p in 0-1) of a histogram in microseconds, returns the upper bound of the bucket it falls into
+	static float percentile (uint64_t const (&hist)[BUCKETS], float p) {
+		uint64_t total = 0;
+		for (int i=0; i<BUCKETS; ++i)
+			total += hist[i];
+		if (total == 0)
+			return 0.0f;
+
+		uint64_t target = (uint64_t)((double)p * (double)total);
+		uint64_t sum = 0;
+		for (int i=0; i<BUCKETS; ++i) {
+			sum += hist[i];
+			if (sum > target)
+				return (float)(1ull << i);
+		}
+		return (float)(1ull << (BUCKETS-1));
+	}
+};
+
+// derive jobs from PooledJob<Job> to allocate them from a slab instead of the heap
+// std::make_unique<Job>() and the unique_ptr deleter go through the class operator new/delete, so the Threadpool queues work unchanged
+// jobs are recycled once their result is consumed (the unique_ptr is destroyed), and live next to each other in one reserved address range
+// each thread keeps a BlockAllocatorCache, so allocating and freeing usually does not touch any shared state
+// MAX_COUNT is the maximum number of jobs alive at once (only address space is reserved for it)
+template <typename DERIVED, uint32_t MAX_COUNT = 1u << 20>
+struct PooledJob {
+	// leaked on purpose, so that it outlives every Threadpool, including global ones whose destructors still free queued jobs and results at exit
+	static ConcurrentBlockAllocator<DERIVED>& job_slab () {
+		static auto* slab = new ConcurrentBlockAllocator<DERIVED>(MAX_COUNT);
+		return *slab;
+	}
+
+	// thread_locals are destroyed before globals, so the cache remembers when it is gone and jobs freed afterwards go to the slab directly
+	enum CacheState { CACHE_NONE, CACHE_ALIVE, CACHE_DESTROYED };
+	static inline thread_local CacheState cache_state = CACHE_NONE; // trivially destructible, so still valid while the thread exits
+
+	struct ThreadCache {
+		BlockAllocatorCache<DERIVED> cache;
+
+		ThreadCache (): cache(&job_slab()) { cache_state = CACHE_ALIVE; }
+		~ThreadCache () { cache_state = CACHE_DESTROYED; } // cache returns its slots to the slab
+	};
+	// nullptr once the calling thread is exiting
+	static BlockAllocatorCache<DERIVED>* job_cache () {
+		if (cache_state == CACHE_DESTROYED)
+			return nullptr;
+		static thread_local ThreadCache c;
+		return &c.cache;
+	}
+
+	static void* operator new (size_t size) {
+		assert(size == sizeof(DERIVED)); // classes derived from DERIVED need their own PooledJob
+		auto* cache = job_cache();
+		return &job_slab()[cache ? cache->alloc() : job_slab().alloc()];
+	}
+	static void operator delete (void* ptr) {
+		if (!ptr) return;
+		uint32_t idx = (uint32_t)((DERIVED*)ptr - job_slab().arr);
+		// don't create a cache just to free (eg. on a thread that only consumes results)
+		if (cache_state == CACHE_ALIVE)
+			job_cache()->free(idx);
+		else
+			job_slab().free(idx);
+	}
+};
+
 // Job threadpool
 // threadpool.push(Job) to queue a job for execution on a thread
 // threads call Job.execute() and std::move() the return value into threadpool.results
 // threadpool.try_pop() to get results
+// jobs can have a 'CancelToken cancel_token' member to be dropped without executing them (see CancelSource)
 // jobs and job results should be default constructable and small and moveable
-template <typename JOB>
+// derive jobs from PooledJob<Job> to avoid a heap allocation per job
+// RESULTS is the type of the results queue, needs push(T), try_pop(T*) and clear() like ThreadsafeQueue (eg. MPMCQueue<std::unique_ptr<JOB>>)
+// bounded queues whose push() waits while they are full need abort() and reset_abort() like MPMCQueue, so that shutdown() and flush() can't get stuck on unconsumed results
+template <typename JOB, typename RESULTS = ThreadsafeQueue<std::unique_ptr<JOB>>>
 class Threadpool {
 	NO_MOVE_COPY_CLASS(Threadpool)
 
 	std::vector< std::thread >	threads;
 
-	void thread_main (std::string thread_name, ThreadPrio prio/*, int preferred_core*/) { // thread_name mainly for debugging
+	void thread_main (int index, std::string thread_name, ThreadPrio prio, int preferred_core) { // thread_name mainly for debugging
 		set_thread_priority(prio);
 
-		//set_thread_preferred_core(preferred_core);
+		ThreadState& state = *thread_states[index];
+		current_thread = &state;
+
+		// always set the affinity, since on linux threads inherit it from the thread that created them (which might be pinned to core 0)
+		if (flags & TPOOL_NUMA)
+			set_thread_numa_node(state.node, preferred_core);
+		else if (preferred_core >= 0)
+			set_thread_preferred_core(preferred_core);
+		else
+			set_thread_excluded_core(flags & TPOOL_RESERVE_MAIN_CORE ? 0 : -1);
 		set_thread_description(thread_name);
 
 		// Wait for one job to pop and execute or until shutdown signal is sent via jobs.shutdown()
+		// tasks (from parallel_for) take priority over jobs, since a thread is waiting for them to complete
 		for (;;) {
+			if (_run_task())
+				continue;
+
+			if (_run_node_job(state.node))
+				continue;
+
+			if (flags & TPOOL_WORK_STEALING) {
+				if (shutdown_requested.load(std::memory_order_relaxed))
+					return;
+
+				if (JOB* job = _find_job(index)) {
+					_execute(std::unique_ptr<JOB>(job));
+					jobs.task_done();
+					continue;
+				}
+			}
+
 			std::unique_ptr<JOB> job;
-			if (jobs.pop_or_shutdown_wait(&job) == decltype(jobs)::SHUTDOWN)
+			auto res = jobs.pop_or_wake_wait(&job, [this, &state] () {
+				return tasks_pending.load(std::memory_order_relaxed) > 0 || stealable.load(std::memory_order_relaxed) > 0 ||
+					node_queues[state.node]->pending.load(std::memory_order_relaxed) > 0;
+			});
+			if (res == decltype(jobs)::SHUTDOWN)
 				return;
+			if (res == decltype(jobs)::WAKE)
+				continue;
+
+			_execute(std::move(job));
+			jobs.task_done();
+		}
+	}
+
+	void _execute (std::unique_ptr<JOB> job) {
+		Counters& counters = _counters();
+
+		if constexpr (requires { { job->cancel_token } -> std::convertible_to<CancelToken const&>; }) {
+			if (job->cancel_token.is_cancelled()) {
+				counters.cancelled.fetch_add(1, std::memory_order_relaxed);
+				return; // dropped lazily here, jobs are never searched for in the queues
+			}
+		}
+
+		uint64_t begin = kiss::get_timestamp();
+		if constexpr (requires { { job->enqueue_time } -> std::convertible_to<uint64_t>; }) {
+			if (job->enqueue_time != 0)
+				counters.add(counters.latency, _to_microseconds(begin - job->enqueue_time));
+		}
+
+		busy_depth++;
+		job->execute();
+		busy_depth--;
+
+		uint64_t end = kiss::get_timestamp();
+		counters.add(counters.exec_time, _to_microseconds(end - begin));
+		counters.executed.fetch_add(1, std::memory_order_relaxed);
+		if (busy_depth == 0)
+			counters.busy_ticks.fetch_add(end - begin, std::memory_order_relaxed);
+
+		results.push(std::move(job)); // can drop the job if the results queue is full and aborted, see _abort_results
+	}
+
+	void _abort_results (bool abort) {
+		if constexpr (requires { results.abort(); }) {
+			if (abort)
+				results.abort();
+			else
+				results.reset_abort();
+		}
+	}
+
+	//// Instrumentation
+	// counters are per thread to avoid all threads writing the same cache line for every job
+	// only written by their thread (except other_thread_counters), so the atomic adds are uncontended
+	struct Counters {
+		std::atomic<uint64_t>	executed = 0;
+		std::atomic<uint64_t>	cancelled = 0;
+		std::atomic<uint64_t>	tasks = 0;
+		std::atomic<uint64_t>	steals = 0;
+		std::atomic<uint64_t>	busy_ticks = 0;
+		std::atomic<uint64_t>	start_time = 0; // timestamp when counting started, idle time is the time since then that was not busy
+
+		std::atomic<uint64_t>	latency[ThreadpoolStats::BUCKETS] = {};
+		std::atomic<uint64_t>	exec_time[ThreadpoolStats::BUCKETS] = {};
+
+		static void add (std::atomic<uint64_t> (&hist)[ThreadpoolStats::BUCKETS], uint64_t microseconds) {
+			hist[ThreadpoolStats::bucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+		}
+		void reset (uint64_t now) {
+			for (auto* c : { &executed, &cancelled, &tasks, &steals, &busy_ticks })
+				c->store(0, std::memory_order_relaxed);
+			for (int i=0; i<ThreadpoolStats::BUCKETS; ++i) {
+				latency[i].store(0, std::memory_order_relaxed);
+				exec_time[i].store(0, std::memory_order_relaxed);
+			}
+			start_time.store(now, std::memory_order_relaxed);
+		}
+	};
+	Counters	other_thread_counters; // for jobs and tasks run by threads that are not part of the threadpool (contribute_work, parallel_for)
+
+	// nesting of jobs and tasks on this thread (eg. tasks run while waiting for a nested parallel_for), to only count the outermost one as busy time
+	static inline thread_local int busy_depth = 0;
+
+	Counters& _counters () {
+		return current_thread && current_thread->pool == this ? current_thread->counters : other_thread_counters;
+	}
+	static uint64_t _to_microseconds (uint64_t ticks) {
+		return ticks * 1000000 / kiss::timestamp_freq;
+	}
+	// for latency measurement of jobs with a 'uint64_t enqueue_time' member
+	static void _stamp (JOB& job) {
+		if constexpr (requires { { job.enqueue_time } -> std::convertible_to<uint64_t>; })
+			job.enqueue_time = kiss::get_timestamp();
+	}
+
+	//// Per thread state
+	struct ThreadState {
+		Threadpool*		pool;
+		int				node; // numa node (0 without TPOOL_NUMA)
+		// created on first use by the thread itself, so its pages are committed (first touched) on the thread's numa node
+		std::unique_ptr<VirtualPushAllocator>	arena;
+
+		Counters		counters;
+	};
+	std::vector< std::unique_ptr<ThreadState> >	thread_states;
+	static inline thread_local ThreadState*		current_thread = nullptr;
+
+	static constexpr size_t THREAD_ARENA_SIZE = 256ull * 1024*1024; // only reserved, memory is committed as needed
+
+	//// Numa node queues
+	struct NodeQueue {
+		ThreadsafeQueue<std::unique_ptr<JOB>>	jobs;
+		std::atomic<int>						pending = 0; // lets waiting threads check for jobs without locking the node queue
+	};
+	std::vector< std::unique_ptr<NodeQueue> >	node_queues;
+
+	bool _run_node_job (int node) {
+		NodeQueue& nq = *node_queues[node];
+
+		std::unique_ptr<JOB> job;
+		if (nq.pending.load(std::memory_order_relaxed) <= 0 || !nq.jobs.try_pop(&job))
+			return false;
+
+		nq.pending.fetch_sub(1, std::memory_order_relaxed);
+		_execute(std::move(job));
+		nq.jobs.task_done();
+		return true;
+	}
+
+	//// Work stealing
+	static constexpr int STEAL_BATCH = 16; // how many jobs a thread takes from the jobs queue at once
+
+	struct Worker {
+		WorkStealingDeque<JOB*>	deque;
+		uint32_t				rand_state; // xorshift32 for picking steal victims
+	};
+	std::vector< std::unique_ptr<Worker> >	workers;
+	std::atomic<int>						stealable = 0; // approximate number of jobs in all deques, lets waiting threads know that they can steal
+	std::atomic<bool>						shutdown_requested = false;
+
+	// own deque -> batch from jobs queue -> steal from random other thread
+	JOB* _find_job (int index) {
+		Worker& self = *workers[index];
+
+		JOB* job;
+		if (self.deque.pop(&job)) {
+			stealable.fetch_sub(1, std::memory_order_relaxed);
+			return job;
+		}
+
+		std::unique_ptr<JOB> batch[STEAL_BATCH];
+		size_t count = jobs.pop_n(batch, STEAL_BATCH);
+		if (count > 0) {
+			// push in reverse, so that our LIFO pops still execute them in queue order
+			int pushed = 0;
+			for (size_t i=count-1; i>0; --i) {
+				if (self.deque.push(batch[i].get())) {
+					batch[i].release();
+					pushed++;
+				} else {
+					// can't happen since the deque was empty, but never lose a job if it does
+					// push counts the job as unfinished again, so undo that with task_done
+					jobs.push(std::move(batch[i]));
+					jobs.task_done();
+				}
+			}
+			if (pushed > 0) {
+				stealable.fetch_add(pushed, std::memory_order_relaxed);
+				jobs.notify_waiters();
+			}
+			return batch[0].release();
+		}
+
+		int n = (int)workers.size();
+		self.rand_state ^= self.rand_state << 13;
+		self.rand_state ^= self.rand_state >> 17;
+		self.rand_state ^= self.rand_state << 5;
+		int start = (int)(self.rand_state % (uint32_t)n);
+
+		for (int i=0; i<n; ++i) {
+			int victim = (start + i) % n;
+			if (victim != index && workers[victim]->deque.steal(&job)) {
+				stealable.fetch_sub(1, std::memory_order_relaxed);
+				thread_states[index]->counters.steals.fetch_add(1, std::memory_order_relaxed);
+				return job;
+			}
+		}
+		return nullptr;
+	}
+
+	ThreadsafeQueue<ThreadpoolTask>	tasks;
+	std::atomic<int>				tasks_pending = 0; // lets waiting threads check for tasks without locking the tasks queue
+
+	bool _run_task () {
+		ThreadpoolTask task;
+		if (tasks_pending.load(std::memory_order_relaxed) <= 0 || !tasks.try_pop(&task))
+			return false;
+
+		tasks_pending.fetch_sub(1, std::memory_order_relaxed);
+
+		Counters& counters = _counters();
+		uint64_t begin = kiss::get_timestamp();
+
+		busy_depth++;
+		task.func(task.data);
+		busy_depth--;
+
+		counters.tasks.fetch_add(1, std::memory_order_relaxed);
+		if (busy_depth == 0)
+			counters.busy_ticks.fetch_add(kiss::get_timestamp() - begin, std::memory_order_relaxed);
+		return true;
+	}
+
+	void _push_tasks (ThreadpoolTask task, int count) {
+		tasks_pending.fetch_add(count, std::memory_order_relaxed);
+		for (int i=0; i<count; ++i)
+			tasks.push(task);
+
+		jobs.notify_waiters();
+	}
+
+	// remove tasks that were not picked up by any thread yet, returns how many were removed
+	int _cancel_tasks (void* data) {
+		int count = (int)tasks.remove_if([data] (ThreadpoolTask& t) { return t.data == data; });
+		tasks_pending.fetch_sub(count, std::memory_order_relaxed);
+		return count;
+	}
+
+	// state of one parallel_for/parallel_reduce call, lives on the stack of the calling thread
+	struct ParallelFor {
+		std::atomic<int64_t>	next;
+		int64_t					end;
+		int64_t					grain; // minimum chunk size
+		int						participants; // helper threads + calling thread
+
+		void					(*run)(ParallelFor* state); // claims and processes chunks until there are none left
+		void*					ctx;
+
+		std::atomic<int>		active; // tasks referencing this state that are not done yet
+
+		// claim the next chunk
+		// chunks start big and get smaller as less work remains (guided scheduling), so that there are few claims but threads still finish at about the same time
+		bool claim (int64_t* chunk_begin, int64_t* chunk_end) {
+			int64_t begin = next.load(std::memory_order_relaxed);
+			for (;;) {
+				if (begin >= end)
+					return false;
+
+				int64_t size = std::max(grain, (end - begin) / (2 * participants));
+				int64_t new_next = std::min(begin + size, end);
+				if (next.compare_exchange_weak(begin, new_next, std::memory_order_relaxed)) {
+					*chunk_begin = begin;
+					*chunk_end = new_next;
+					return true;
+				}
+			}
+		}
+		static void task (void* data) {
+			auto* state = (ParallelFor*)data;
+			state->run(state);
+			state->active.fetch_sub(1, std::memory_order_release);
+		}
+	};
+
+	void _fork_join (int64_t begin, int64_t end, int64_t grain, void (*run)(ParallelFor* state), void* ctx) {
+		if (end <= begin)
+			return;
+		grain = std::max(grain, (int64_t)1);
+
+		int64_t chunks = (end - begin + grain-1) / grain;
+		int helpers = (int)std::min((int64_t)threads.size(), chunks - 1);
+
+		ParallelFor state;
+		state.next.store(begin, std::memory_order_relaxed);
+		state.end = end;
+		state.grain = grain;
+		state.participants = helpers + 1;
+		state.run = run;
+		state.ctx = ctx;
+		state.active.store(helpers, std::memory_order_relaxed);
+
+		if (helpers > 0)
+			_push_tasks({ &ParallelFor::task, &state }, helpers);
+
+		// the calling thread works on chunks as well
+		run(&state);
+
+		// tasks that did not start yet can't find any chunks anymore, just remove them
+		if (helpers > 0)
+			state.active.fetch_sub(_cancel_tasks(&state), std::memory_order_relaxed);
+
+		// wait for threads that are still working on their last chunk, help out with other tasks in the meantime (eg. nested parallel_for)
+		while (state.active.load(std::memory_order_acquire) > 0) {
+			if (!_run_task())
+				std::this_thread::yield();
+		}
+	}
+
+	// nodes of all running TaskGraphs that are not done yet, they are not counted in any queue, so wait_idle needs this to wait for them
+	std::atomic<int> graph_nodes = 0;
+	// incremented every time a graph node is done, waiters sleep on this with atomic wait (the graph itself can't be notified, it might already be destroyed)
+	std::atomic<uint32_t> graph_nodes_done = 0;
+	std::atomic<uint32_t> graph_waiters = 0;
+
+	// runs a node of a TaskGraph and then its successors that became ready
+	// the first ready successor is run directly on this thread (no queue round trip for simple chains), the others are pushed as tasks
+	template <typename GRAPH>
+	void _run_graph_node (GRAPH& graph, uint32_t node) {
+		while (node != GRAPH::NONE) {
+			auto& n = graph.nodes[node];
+			if (n.job)
+				_execute(std::move(n.job));
+			else
+				n.task.func(n.task.data);
+
+			uint32_t next = GRAPH::NONE;
+			for (uint32_t e=n.first_edge; e != GRAPH::NONE; e = graph.edges[e].next) {
+				uint32_t succ = graph.edges[e].successor;
+				if (graph.pending[succ].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					if (next == GRAPH::NONE)
+						next = succ;
+					else
+						_push_tasks({ &GRAPH::node_task, &graph.nodes[succ] }, 1);
+				}
+			}
+
+			// graph can be destroyed by the waiting thread once remaining reaches 0, so don't touch it afterwards
+			// (if there is a next node, remaining can't reach 0 here)
+			graph.remaining.fetch_sub(1, std::memory_order_release);
+			graph_nodes.fetch_sub(1, std::memory_order_release);
 
-			job->execute();
-			results.push(std::move(job));
+			graph_nodes_done.fetch_add(1, std::memory_order_seq_cst);
+			if (graph_waiters.load(std::memory_order_seq_cst) > 0)
+				graph_nodes_done.notify_all();
+			node = next;
 		}
 	}
 
+	// wait until template callback 'bool done ()' returns true, helps executing tasks in the meantime
+	// sleeps when there is nothing to help with and rechecks done() whenever a graph node finishes
+	template <typename DONE>
+	void _wait_graph_nodes (DONE done) {
+		while (!done()) {
+			if (_run_task())
+				continue;
+
+			uint32_t count = graph_nodes_done.load(std::memory_order_seq_cst);
+			graph_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+			if (!done() && tasks_pending.load(std::memory_order_relaxed) <= 0)
+				graph_nodes_done.wait(count, std::memory_order_seq_cst);
+
+			graph_waiters.fetch_sub(1, std::memory_order_seq_cst);
+		}
+	}
+
+	static constexpr int DEFAULT_SPIN_COUNT = 2000;
+
 	std::string thread_base_name;
 	ThreadPrio prio;
+	ThreadpoolFlags flags = TPOOL_DEFAULT;
 
 public:
 	// jobs.push(Job) to queue work to be executed by a thread
+	// jobs.set_priority_levels(n) + jobs.push(Job, prio) to have urgent jobs (prio 0) always run before less urgent ones, jobs.size(prio) for queue depths
 	ThreadsafeQueue<std::unique_ptr<JOB>> jobs;
 	// jobs.try_pop(Job) to dequeue the results of the jobs
-	ThreadsafeQueue<std::unique_ptr<JOB>> results;
+	RESULTS results;
 
 	// don't start threads
 	Threadpool () {}
 	// start thread_count threads
-	Threadpool (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>") {
-		start_threads(thread_count, prio, std::move(thread_base_name));
+	Threadpool (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>", ThreadpoolFlags flags=TPOOL_DEFAULT) {
+		start_threads(thread_count, prio, std::move(thread_base_name), flags);
 	}
 
 	// start thread_count threads
-	void start_threads (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>") {
+	// only valid while no threads are running (after the default constructor or shutdown()), since the per-thread state is indexed from 0 and flags apply to the whole pool
+	void start_threads (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>", ThreadpoolFlags flags=TPOOL_DEFAULT) {
 		THREADPOOL_PROFILER_SCOPED("Threadpool::start_threads");
+		assert(threads.empty() && workers.empty() && thread_states.empty() && node_queues.empty());
+
+		this->flags = flags;
+		// reset when restarting without the flag, spinning is pointless if the process can only run on a single core
+		bool spin = (flags & TPOOL_SPIN_WAIT) && get_process_core_count() > 1;
+		jobs.set_spin_count(spin ? DEFAULT_SPIN_COUNT : 0);
+		if (flags & TPOOL_WORK_STEALING) {
+			for (int i=0; i<thread_count; ++i) {
+				workers.emplace_back(std::make_unique<Worker>());
+				workers[i]->rand_state = 0x9E3779B9u * (uint32_t)(i+1);
+			}
+		}
 		
-		//// Threadpools are ideally used with  thread_count <= cpu_core_count  to make use of the cpu without the threads preempting each other (although I don't check the thread count)
-		//// I'm just assuming for now that with  high_prio==false -> thread_count==cpu_core_count -> ie. set each threads affinity to one of the cores
-		////  and with high_prio==true you leave at least one core free for the main thread, so we assign the cores 1-n to the threads so that the main thread can be on core 0
-		//int cpu_core = prio == ThreadPriority::HIGH ? 1 : 0;
+		// Threadpools are ideally used with  thread_count <= cpu_core_count  to make use of the cpu without the threads preempting each other (although I don't check the thread count)
+		// with TPOOL_PIN_THREADS each thread gets one of the cores, with TPOOL_RESERVE_MAIN_CORE we assign the cores 1-n to the threads so that the main thread can be on core 0
+		// with TPOOL_NUMA threads are distributed round robin over the nodes, cpu_core is then the index of the core in the node
+		int cores = get_process_core_count();
+		bool reserve = (flags & TPOOL_RESERVE_MAIN_CORE) && cores > 1;
+		int nodes = flags & TPOOL_NUMA ? (int)get_numa_nodes().size() : 1;
+		// only nodes that get at least one thread, since jobs pushed to a node queue without threads would never run (and wait_idle would hang)
+		nodes = std::max(std::min(nodes, thread_count), 1);
+
+		for (int i=0; i<nodes; ++i)
+			node_queues.emplace_back(std::make_unique<NodeQueue>());
+
+		for (int i=0; i<thread_count; ++i) {
+			thread_states.emplace_back(std::make_unique<ThreadState>());
+			thread_states[i]->pool = this;
+			thread_states[i]->node = i % nodes;
+			thread_states[i]->counters.reset(kiss::get_timestamp());
+		}
 
 		for (int i=0; i<thread_count; ++i) {
-			threads.emplace_back( &Threadpool::thread_main, this, kiss::prints("%s #%d", thread_base_name.c_str(), i), prio/*, cpu_core++*/);
+			int cpu_core = -1;
+			if ((flags & TPOOL_PIN_THREADS) && (flags & TPOOL_NUMA))
+				cpu_core = i / nodes;
+			else if (flags & TPOOL_PIN_THREADS)
+				cpu_core = reserve ? 1 + i % (cores-1) : i % std::max(cores, 1);
+
+			threads.emplace_back( &Threadpool::thread_main, this, i, kiss::prints("%s #%d", thread_base_name.c_str(), i), prio, cpu_core);
 		}
 
 		this->thread_base_name = std::move(thread_base_name);
@@ -115,41 +710,450 @@ public:
 		THREADPOOL_PROFILER_SCOPED("Threadpool::contribute_work");
 
 		// Wait for one job to pop and execute or until shutdown signal is sent via jobs.shutdown()
+		// also helps with tasks (eg. parallel_for issued from inside jobs)
 		for (;;) {
-			JOB job;
+			if (_run_task())
+				continue;
+
+			std::unique_ptr<JOB> job;
 			if (!jobs.try_pop(&job))
 				return;
 
-			job.execute();
-			results.push(std::move(job));
+			_execute(std::move(job));
+			jobs.task_done();
 		}
 	}
 
+	// run a task 'void func (void* data)' on one of the threads, tasks are run before any queued jobs
+	// used to resume coroutines on the threadpool (see schedule_on in coroutines.hpp)
+	// tasks that did not run yet are dropped on shutdown()
+	void post (ThreadpoolTask task) {
+		_push_tasks(task, 1);
+	}
+
+	// dependency graph of jobs and tasks, started with run_graph()
+	// each node has a counter of unfinished dependencies and is queued automatically once it reaches 0
+	// nodes and edges are stored in flat vectors (edges as linked lists of indices), so adding dependencies does not do a heap allocation per edge
+	//  and clear() keeps the memory around for building the graph again next frame
+	// the graph has to be acyclic and can't be changed or destroyed while running (check done() or call wait_graph())
+	/* pattern:
+		TaskGraph graph;
+		auto gen   = graph.add_job(std::make_unique<GenJob>(chunk));
+		auto light = graph.add_job(std::make_unique<LightJob>(chunk));
+		graph.add_dependency(gen, light); // light only starts once gen is done
+		// + add_dependency(neighbour_gen, light) for each neighbour
+		
+		threadpool.run_graph(graph);
+		...
+		if (graph.done()) // or threadpool.wait_graph(graph)
+			graph.clear();
+	*/
+	class TaskGraph {
+		NO_MOVE_COPY_CLASS(TaskGraph)
+		friend class Threadpool;
+
+		static constexpr uint32_t NONE = (uint32_t)-1;
+
+		struct Node {
+			TaskGraph*				graph;
+			uint32_t				index;
+			// either a job (executed and pushed into results like normal jobs) or a task
+			std::unique_ptr<JOB>	job;
+			ThreadpoolTask			task;
+
+			uint32_t				first_edge = NONE; // linked list of successors in edges
+			int						dependencies = 0;
+		};
+		struct Edge {
+			uint32_t	successor;
+			uint32_t	next;
+		};
+
+		std::vector<Node>	nodes;
+		std::vector<Edge>	edges;
+
+		// per node counter of unfinished dependencies, separate from nodes since atomics are not movable
+		std::unique_ptr<std::atomic<int>[]>	pending;
+		size_t								pending_size = 0;
+
+		std::atomic<uint32_t>	remaining = 0; // nodes not done yet
+		Threadpool*				pool = nullptr;
+
+		uint32_t _add (Node&& node) {
+			assert(done());
+			uint32_t index = (uint32_t)nodes.size();
+			node.graph = this;
+			node.index = index;
+			nodes.emplace_back(std::move(node));
+			return index;
+		}
+
+		static void node_task (void* data) {
+			auto* node = (Node*)data;
+			node->graph->pool->_run_graph_node(*node->graph, node->index);
+		}
+
+	public:
+		typedef uint32_t NodeId;
+
+		TaskGraph () {}
+
+		// add a job, which is executed and pushed into the results of the threadpool like normal jobs
+		NodeId add_job (std::unique_ptr<JOB> job) {
+			Node n;
+			n.job = std::move(job);
+			return _add(std::move(n));
+		}
+		// add a task 'void func (void* data)'
+		NodeId add_task (ThreadpoolTask task) {
+			Node n;
+			n.task = task;
+			return _add(std::move(n));
+		}
+
+		// after will only start once before is done
+		void add_dependency (NodeId before, NodeId after) {
+			assert(done());
+			assert(before < nodes.size() && after < nodes.size() && before != after);
+
+			edges.push_back({ after, nodes[before].first_edge });
+			nodes[before].first_edge = (uint32_t)edges.size()-1;
+			nodes[after].dependencies++;
+		}
+
+		size_t size () const {
+			return nodes.size();
+		}
+
+		// all nodes of the last run_graph are done (also true if it was never run)
+		bool done () const {
+			return remaining.load(std::memory_order_acquire) == 0;
+		}
+
+		// remove all nodes, keeps the memory for reuse
+		void clear () {
+			assert(done());
+			nodes.clear();
+			edges.clear();
+		}
+	};
+
+	// start executing a TaskGraph on the threadpool threads, returns immediately
+	// nodes without dependencies are queued right away, the others as soon as all their dependencies are done
+	// job nodes are moved into results once executed, so only graphs that contain only tasks can be run again
+	void run_graph (TaskGraph& graph) {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::run_graph");
+		assert(graph.done());
+
+		uint32_t count = (uint32_t)graph.nodes.size();
+		if (count == 0)
+			return;
+
+		if (graph.pending_size < count) {
+			graph.pending = std::make_unique<std::atomic<int>[]>(count);
+			graph.pending_size = count;
+		}
+		for (uint32_t i=0; i<count; ++i)
+			graph.pending[i].store(graph.nodes[i].dependencies, std::memory_order_relaxed);
+
+		graph.pool = this;
+		graph.remaining.store(count, std::memory_order_relaxed);
+		graph_nodes.fetch_add((int)count, std::memory_order_relaxed);
+
+		int roots = 0;
+		for (uint32_t i=0; i<count; ++i) {
+			if (graph.nodes[i].dependencies == 0)
+				roots++;
+		}
+		assert(roots > 0); // graph has a cycle
+
+		tasks_pending.fetch_add(roots, std::memory_order_relaxed);
+		for (uint32_t i=0; i<count; ++i) {
+			if (graph.nodes[i].dependencies == 0)
+				tasks.push({ &TaskGraph::node_task, &graph.nodes[i] });
+		}
+		jobs.notify_waiters();
+	}
+
+	// wait for all nodes of a running TaskGraph to be done, helps executing tasks in the meantime
+	void wait_graph (TaskGraph& graph) {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::wait_graph");
+
+		_wait_graph_nodes([&] () { return graph.done(); });
+	}
+
+	// split [begin, end) into chunks and call fn(int64_t chunk_begin, int64_t chunk_end) for each of them
+	// on the threadpool threads and the calling thread, returns once all chunks are done
+	// grain is the minimum chunk size, chunks are bigger at the start and get smaller towards the end to balance the load
+	// fn is called concurrently from multiple threads
+	template <typename FUNC>
+	void parallel_for (int64_t begin, int64_t end, int64_t grain, FUNC fn) {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::parallel_for");
+
+		_fork_join(begin, end, grain, [] (ParallelFor* state) {
+			auto& fn = *(FUNC*)state->ctx;
+
+			int64_t chunk_begin, chunk_end;
+			while (state->claim(&chunk_begin, &chunk_end))
+				fn(chunk_begin, chunk_end);
+		}, &fn);
+	}
+
+	// like parallel_for, but each chunk returns a value 'T fn (int64_t chunk_begin, int64_t chunk_end)'
+	// which are combined with 'T combine (T a, T b)' into the returned result, starting from identity
+	// combine has to be associative and commutative, since the order of chunks is not deterministic
+	// each thread combines its chunks locally, so combine is only called under a lock once per thread
+	template <typename T, typename FUNC, typename COMBINE>
+	T parallel_reduce (int64_t begin, int64_t end, int64_t grain, T identity, FUNC fn, COMBINE combine) {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::parallel_reduce");
+
+		struct Ctx {
+			FUNC&		fn;
+			COMBINE&	combine;
+			T const&	identity;
+			T			result;
+			std::mutex	mutex;
+		} ctx { fn, combine, identity, identity };
+
+		_fork_join(begin, end, grain, [] (ParallelFor* state) {
+			auto& ctx = *(Ctx*)state->ctx;
+
+			T local = ctx.identity;
+			bool any = false;
+
+			int64_t chunk_begin, chunk_end;
+			while (state->claim(&chunk_begin, &chunk_end)) {
+				local = ctx.combine(std::move(local), ctx.fn(chunk_begin, chunk_end));
+				any = true;
+			}
+
+			if (any) {
+				std::lock_guard lock(ctx.mutex);
+				ctx.result = ctx.combine(std::move(ctx.result), std::move(local));
+			}
+		}, &ctx);
+
+		return std::move(ctx.result);
+	}
+
+	// number of numa nodes threads are distributed over (1 without TPOOL_NUMA)
+	// can be less than get_numa_nodes().size() if there are fewer threads than nodes, push_to_node only accepts nodes below this
+	int numa_node_count () {
+		return (int)node_queues.size();
+	}
+
+	// queue a job that is only executed by the threads of a numa node (TPOOL_NUMA), for jobs that work on memory that was allocated on that node
+	// without TPOOL_NUMA there is only node 0 which all threads belong to
+	// threads prefer jobs of their node over the normal jobs queue
+	void push_to_node (std::unique_ptr<JOB> job, int node) {
+		assert(node >= 0 && node < (int)node_queues.size());
+		NodeQueue& nq = *node_queues[node];
+
+		_stamp(*job);
+		nq.pending.fetch_add(1, std::memory_order_relaxed);
+		nq.jobs.push(std::move(job));
+
+		jobs.notify_waiters();
+	}
+
+	// numa node of the calling thread if it is one of the threads of this threadpool, -1 otherwise
+	int thread_numa_node () {
+		return current_thread && current_thread->pool == this ? current_thread->node : -1;
+	}
+
+	// per thread arena for temporary allocations in Job.execute(), only call from the threads of this threadpool
+	// memory is committed by the thread itself, so with TPOOL_NUMA it ends up on the thread's node
+	// use ScopedMarker or reset() to free the allocations at the end of the job
+	VirtualPushAllocator& thread_arena () {
+		assert(current_thread && current_thread->pool == this);
+
+		auto& arena = current_thread->arena;
+		if (!arena)
+			arena = std::make_unique<VirtualPushAllocator>(THREAD_ARENA_SIZE);
+		return *arena;
+	}
+
+	// number of jobs executed and cancelled (dropped due to their cancel_token) since the threads were started, for tuning
+	uint64_t jobs_executed () {
+		uint64_t count = other_thread_counters.executed.load(std::memory_order_relaxed);
+		for (auto& t : thread_states)
+			count += t->counters.executed.load(std::memory_order_relaxed);
+		return count;
+	}
+	uint64_t jobs_cancelled () {
+		uint64_t count = other_thread_counters.cancelled.load(std::memory_order_relaxed);
+		for (auto& t : thread_states)
+			count += t->counters.cancelled.load(std::memory_order_relaxed);
+		return count;
+	}
+
+	// snapshot of the counters of all threads since start_threads() or reset_stats(), can be called at any time from any thread
+	// use it to size thread_count: low utilization means too many threads, high latency with high utilization means too few
+	ThreadpoolStats stats () {
+		ThreadpoolStats s;
+		uint64_t now = kiss::get_timestamp();
+
+		auto sum = [&] (Counters& c) {
+			s.jobs_executed  += c.executed.load(std::memory_order_relaxed);
+			s.jobs_cancelled += c.cancelled.load(std::memory_order_relaxed);
+			s.tasks_run      += c.tasks.load(std::memory_order_relaxed);
+			s.steals         += c.steals.load(std::memory_order_relaxed);
+			for (int i=0; i<ThreadpoolStats::BUCKETS; ++i) {
+				s.latency[i]   += c.latency[i].load(std::memory_order_relaxed);
+				s.exec_time[i] += c.exec_time[i].load(std::memory_order_relaxed);
+			}
+		};
+
+		sum(other_thread_counters);
+		for (auto& t : thread_states) {
+			sum(t->counters);
+
+			uint64_t busy = t->counters.busy_ticks.load(std::memory_order_relaxed);
+			uint64_t total = now - t->counters.start_time.load(std::memory_order_relaxed);
+			s.busy_seconds += (double)busy / (double)kiss::timestamp_freq;
+			s.idle_seconds += (double)(total > busy ? total - busy : 0) / (double)kiss::timestamp_freq;
+		}
+
+		s.jobs_high_water = jobs.high_water_mark();
+		return s;
+	}
+
+	// restart counting, eg. after loading when only the steady state is of interest
+	// not exact if jobs are running concurrently
+	void reset_stats () {
+		uint64_t now = kiss::get_timestamp();
+		other_thread_counters.reset(now);
+		for (auto& t : thread_states)
+			t->counters.reset(now);
+		jobs.reset_high_water_mark();
+	}
+
+	// push a job onto the jobs queue, same as jobs.push() but also sets the 'uint64_t enqueue_time' member of the job if it has one
+	// which is used to measure the latency from push to execute in stats()
+	void push (std::unique_ptr<JOB> job, int prio=0) {
+		_stamp(*job);
+		jobs.push(std::move(job), prio);
+	}
+	void push_n (std::unique_ptr<JOB>* job, size_t count, int prio=0) {
+		for (size_t i=0; i<count; ++i)
+			_stamp(*job[i]);
+		jobs.push_n(job, count, prio);
+	}
+
+	// block until all jobs pushed so far are executed (their results are in results), without stopping the threads
+	// only waits, jobs are executed by the threads (call contribute_work() first to help)
+	// jobs pushed concurrently from other threads or from inside jobs are waited for as well, and so are all running TaskGraphs
+	// with a bounded RESULTS queue (MPMCQueue) a job only counts as done once its result fits into the queue,
+	// so more unconsumed results than its capacity block this until another thread pops results (use flush() if the results are not needed)
+	// never returns when
+	//  - called from inside a job or task of this pool, since the calling job itself is never done (use wait_graph or parallel_for for nested waiting)
+	//  - user code pops from jobs directly (jobs.try_pop etc.) without calling jobs.task_done() for each popped job (contribute_work() does this)
+	void wait_idle () {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::wait_idle");
+		assert(!(current_thread && current_thread->pool == this)); // called from a thread of this pool, would deadlock
+
+		// jobs can push jobs into other queues or start graphs and graph nodes can push jobs, so repeat until all of them are idle
+		for (;;) {
+			// help with the graph nodes like wait_graph does
+			_wait_graph_nodes([this] () { return graph_nodes.load(std::memory_order_acquire) == 0; });
+
+			jobs.join();
+			for (auto& nq : node_queues)
+				nq->jobs.join();
+
+			bool idle = jobs.unfinished_count() == 0 && graph_nodes.load(std::memory_order_acquire) == 0;
+			for (auto& nq : node_queues)
+				idle = idle && nq->jobs.unfinished_count() == 0;
+			if (idle)
+				return;
+		}
+	}
+
+	// drop all jobs that were not started yet, jobs that are currently executing still finish normally
+	// TaskGraph nodes are not dropped, running graphs still complete
+	// returns the number of dropped jobs
+	size_t cancel () {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::cancel");
+
+		size_t count = jobs.size();
+		jobs.clear();
+
+		for (auto& nq : node_queues) {
+			size_t removed = nq->jobs.remove_if([] (std::unique_ptr<JOB>&) { return true; });
+			nq->pending.fetch_sub((int)removed, std::memory_order_relaxed);
+			count += removed;
+		}
+
+		// jobs already taken into the work stealing deques, steal() is allowed from any thread
+		size_t stolen = 0;
+		for (auto& w : workers) {
+			JOB* job;
+			while (w->deque.size() > 0) {
+				if (w->deque.steal(&job)) {
+					stealable.fetch_sub(1, std::memory_order_relaxed);
+					delete job;
+					stolen++;
+				}
+			}
+		}
+		jobs.task_done(stolen);
+
+		return count + stolen;
+	}
+
 	// optional manual shutdown
 	void shutdown () {
 		THREADPOOL_PROFILER_SCOPED("Threadpool::shutdown");
 
+		shutdown_requested.store(true, std::memory_order_relaxed);
 		if (!threads.empty())
 			jobs.shutdown(); // set shutdown to all threads
 
+		// threads waiting to push into a full results queue would never exit thread_main
+		_abort_results(true);
+
 		for (auto& t : threads)
 			t.join(); // wait for all threads to exit thread_main
 
+		_abort_results(false);
 		jobs.reset_shutdown();
+		shutdown_requested.store(false, std::memory_order_relaxed);
+
+		// delete jobs that were left in the work stealing deques
+		size_t deleted = 0;
+		for (auto& w : workers) {
+			JOB* job;
+			while (w->deque.pop(&job)) {
+				delete job;
+				deleted++;
+			}
+		}
+		jobs.task_done(deleted);
+		workers.clear();
+		stealable.store(0, std::memory_order_relaxed);
 
 		threads.clear();
+		thread_states.clear();
+		other_thread_counters.reset(0);
+		node_queues.clear();
 		jobs.clear();
 		results.clear();
+		tasks.clear();
+		tasks_pending.store(0, std::memory_order_relaxed);
+		graph_nodes.store(0, std::memory_order_relaxed); // graph nodes that were still queued as tasks never run
 	}
 
+	// drop all queued jobs, wait for the executing ones (and running TaskGraphs) to finish and clear their results
+	// threads keep running, so this is cheap enough to do on level changes etc.
 	void flush () {
-		// TODO: could not find a better way of doing this yet. simply restart the threads for now
-
-		int thread_count = (int)threads.size();
+		THREADPOOL_PROFILER_SCOPED("Threadpool::flush");
 
-		shutdown();
-
-		start_threads(thread_count, prio, std::move(thread_base_name));
+		cancel();
+		// the results are cleared anyway, so drop them instead of waiting for space in a full results queue
+		_abort_results(true);
+		wait_idle();
+		_abort_results(false);
+		results.clear();
 	}
 
 	~Threadpool () {
@@ -4,8 +4,20 @@
 #include <condition_variable>
 #include <algorithm>
 #include <vector>
+#include <atomic>
+#include "assert.h"
 #include "stl_extensions.hpp"
 
+// hint to the cpu that we are in a spin loop (saves power and frees resources for the other hyperthread)
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#include <immintrin.h>
+	#define THREADSAFE_QUEUE_CPU_PAUSE() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+	#define THREADSAFE_QUEUE_CPU_PAUSE() __asm__ __volatile__("yield")
+#else
+	#define THREADSAFE_QUEUE_CPU_PAUSE()
+#endif
+
 #include "tracy/Tracy.hpp"
 #ifdef TRACY_ENABLE
 	// Need to wrap locks for tracy
@@ -32,41 +44,181 @@ class ThreadsafeQueue {
 	CONDITION_VARIABLE;
 
 	// used like a queue but using a deque to support iteration (a queue is just wrapper around a deque, so it is not less efficient to use a deque over a queue)
-	std::deque<T>			q;
+	// one deque per priority level, q[0] is the highest priority, items are always popped from the highest priority non-empty deque
+	// this avoids having to sort() the queue for simple prioritization
+	std::vector<std::deque<T>>	q = std::vector<std::deque<T>>(1);
+	size_t						count = 0; // total items in all priority levels
+	std::atomic<size_t>			visible_count = 0; // copy of count that spinning consumers can read without the lock
+	size_t						high_water = 0; // max count since the last reset_high_water_mark()
+
+	// pushed items that were not marked as done via task_done() yet (includes popped items that are still being processed)
+	// only meaningful if consumers call task_done(), used by join()
+	// atomic so that task_done() only needs to lock when the last item is done
+	std::atomic<size_t>			unfinished = 0;
+	std::condition_variable_any	done_c;
+
+	// consumers sleeping in c waiting for single items, push only notifies if there are any
+	// (consumers that are still spinning are not counted, they see the new item by themselves)
+	size_t						pop_waiters = 0;
+
+	// consumers spin for up to spin_count iterations before going to sleep (see set_spin_count)
+	std::atomic<int>			spin_count = 0;
+
+	// spin until ready() returns true or spin_count iterations are over, returns ready()
+	template <typename READY>
+	bool _spin (READY ready) {
+		int iterations = spin_count.load(std::memory_order_relaxed);
+		if (iterations <= 0)
+			return false;
+
+		for (int i=0; i<iterations; ++i) {
+			if (ready())
+				return true;
+			THREADSAFE_QUEUE_CPU_PAUSE();
+		}
+		return ready();
+	}
+	// consumers waiting for a number of items (pop_n_wait, pop_all_wait) wait in count_c instead
+	// and are only woken once count reaches the smallest min of the waiters, instead of on every push
+	std::condition_variable_any	count_c;
+	size_t						count_threshold = (size_t)-1;
+
+	// call with lock held after count increased
+	void _pushed () {
+		high_water = std::max(high_water, count);
+
+		if (count >= count_threshold) {
+			// woken waiters that are still not satisfied set their threshold again
+			count_threshold = (size_t)-1;
+			count_c.notify_all();
+		}
+	}
+	// call with lock held
+	template <typename LOCK>
+	void _wait_for_count (LOCK& lock, size_t min) {
+		while (count < min) {
+			count_threshold = std::min(count_threshold, min);
+			count_c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		}
+	}
+	// call with lock held
+	template <typename LOCK>
+	void _wait_for_item (LOCK& lock) {
+		pop_waiters++;
+		c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		pop_waiters--;
+	}
+
+	std::deque<T>& _front_level () {
+		for (auto& level : q) {
+			if (!level.empty())
+				return level;
+		}
+		assert(false);
+		return q[0];
+	}
+	T _pop_front () {
+		auto& level = _front_level();
+		T val = std::move(level.front());
+		level.pop_front();
+		count--;
+		visible_count.store(count, std::memory_order_relaxed);
+		return val;
+	}
+
+	// call with lock held
+	void _finished (size_t n) {
+		size_t prev = unfinished.fetch_sub(n, std::memory_order_acq_rel);
+		assert(prev >= n);
+		if (prev == n && n > 0)
+			done_c.notify_all();
+	}
 
 	// use is optional (makes sense to use this to stop threads of thread pools (ie. use this on the job queue), but does not make sense to use this on the results queue)
 	bool					shutdown_flag = false;
 
 public:
+	// let consumers spin for up to iterations (with a cpu pause instruction) before going to sleep when the queue is empty
+	// when items arrive in bursts this avoids a full sleep + wake of the consumer (tens of microseconds) for every burst, at the cost of burning cpu while idle
+	// a pause takes ~10-150 cycles depending on the cpu, so 1000 iterations is somewhere around 5-50 us
+	// 0 (default) to sleep right away
+	// spinning only makes sense if the producer can run at the same time, so only enable it if the process can run on more than one core
+	// (Threadpool checks get_process_core_count() for TPOOL_SPIN_WAIT, which respects the process affinity unlike std::thread::hardware_concurrency())
+	void set_spin_count (int iterations) {
+		spin_count.store(iterations, std::memory_order_relaxed);
+	}
+
+	// number of consumers currently sleeping while waiting for an item
+	size_t sleeping_consumers () {
+		LOCK_GUARD;
+		return pop_waiters;
+	}
+
+	// set the number of priority levels for push(elem, prio), level 0 is popped first
+	// items in levels that are removed are moved into the new lowest priority level
+	void set_priority_levels (int levels) {
+		LOCK_GUARD;
+		assert(levels >= 1);
+
+		for (size_t i=(size_t)levels; i<q.size(); ++i) {
+			for (auto& item : q[i])
+				q[levels-1].emplace_back( std::move(item) );
+		}
+		q.resize(levels);
+	}
+	int priority_levels () {
+		LOCK_GUARD;
+		return (int)q.size();
+	}
+
 	// push one element onto the queue
-	void push (T elem) {
+	// prio: priority level, 0 is the highest priority (see set_priority_levels)
+	void push (T elem, int prio=0) {
+		bool wake;
 		{
 			LOCK_GUARD;
+			assert(prio >= 0 && prio < (int)q.size());
+
+			q[prio].emplace_back( std::move(elem) );
+			count++;
+			visible_count.store(count, std::memory_order_release);
+			unfinished.fetch_add(1, std::memory_order_relaxed);
 
-			q.emplace_back( std::move(elem) );
+			_pushed();
+			wake = pop_waiters > 0;
 		}
 		
 		// do notify outside of loop to avoid threads waking up only to see we have still locked the mutex
-		c.notify_one();
+		if (wake)
+			c.notify_one();
 	}
 
 	// push multiple elements onto the queue
-	void push_n (T* elem, size_t count) {
+	void push_n (T* elem, size_t n, int prio=0) {
 		ZoneScoped;
+		size_t wake;
 		{
 			LOCK_GUARD;
+			assert(prio >= 0 && prio < (int)q.size());
 
-			for (size_t i=0; i<count; ++i) {
-				q.emplace_back( std::move(elem[i]) );
+			for (size_t i=0; i<n; ++i) {
+				q[prio].emplace_back( std::move(elem[i]) );
 			}
+			count += n;
+			visible_count.store(count, std::memory_order_release);
+			unfinished.fetch_add(n, std::memory_order_relaxed);
+
+			_pushed();
+			wake = std::min(pop_waiters, n);
 		}
 
 		// do notify outside of loop to avoid threads waking up only to see we have still locked the mutex
-		if (count > 1) {
+		// one notification for the whole batch, and only if anyone is waiting for single items
+		if (wake > 1) {
 			// prefer notify_all to notify_one, since a loop of notify_one is prone to be preempted in my testing
 			// note that more threads than required might be woken but they will correctly check for that
 			c.notify_all();
-		} else {
+		} else if (wake == 1) {
 			c.notify_one();
 		}
 	}
@@ -74,15 +226,14 @@ public:
 	// wait to dequeue one element from the queue
 	// can be called from multiple threads (multiple consumer)
 	T pop_wait () {
+		_spin([this] () { return visible_count.load(std::memory_order_acquire) > 0; });
 		UNIQUE_LOCK;
 
-		while (q.empty()) {
-			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		while (count == 0) {
+			_wait_for_item(lock);
 		}
 
-		T val = std::move(q.front());
-		q.pop_front();
-		return val;
+		return _pop_front();
 	}
 
 	// deque one element from the queue if there is one
@@ -90,57 +241,49 @@ public:
 	bool try_pop (T* out) {
 		LOCK_GUARD;
 
-		if (q.empty())
+		if (count == 0)
 			return false;
 
-		*out = std::move(q.front());
-		q.pop_front();
+		*out = _pop_front();
 		return true;
 	}
 
-	// Don't like the fact that thread is woken up just to check a number an go back to sleep potentially lots of times
-	// might as well actually process the result
-	// TODO: find a good way of only waking thread up when desired number of results are done
-#if 1
 	// wait until min elements are available, then dequeue up to max elements
+	// the thread is only woken once min elements are available, not on every push
 	// writes the elements into their repective indicies in output
 	// returns the number of elements dequeued
 	size_t pop_n_wait (T output[], size_t min, size_t max) {
+		_spin([this, min] () { return visible_count.load(std::memory_order_acquire) >= min; });
 		UNIQUE_LOCK;
 
-		while (q.size() < min) {
-			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
-		}
+		_wait_for_count(lock, min);
 
-		size_t count = std::min(q.size(), max);
-		for (size_t i=0; i<count; ++i) {
-			output[i] = std::move(q.front());
-			q.pop_front();
+		size_t n = std::min(count, max);
+		for (size_t i=0; i<n; ++i) {
+			output[i] = _pop_front();
 		}
 
-		return count;
+		return n;
 	}
 
 	// wait until min elements are available, then dequeue all elements
+	// the thread is only woken once min elements are available, not on every push
 	// returns the number of elements dequeued
 	size_t pop_all_wait (std_vector<T>* output, size_t min) {
+		_spin([this, min] () { return visible_count.load(std::memory_order_acquire) >= min; });
 		UNIQUE_LOCK;
 
-		while (q.size() < min) {
-			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
-		}
+		_wait_for_count(lock, min);
 
-		size_t count = q.size();
-		output->reserve(count);
+		size_t n = count;
+		output->reserve(n);
 
-		for (size_t i=0; i<count; ++i) {
-			output->emplace_back( std::move(q.front()) );
-			q.pop_front();
+		for (size_t i=0; i<n; ++i) {
+			output->emplace_back( _pop_front() );
 		}
 
-		return count;
+		return n;
 	}
-#endif
 
 	// dequeue up to max elements (or none); never waits
 	// writes the elements into their repective indicies in output
@@ -148,13 +291,12 @@ public:
 	size_t pop_n (T output[], size_t max) {
 		LOCK_GUARD;
 
-		size_t count = std::min(q.size(), max);
-		for (size_t i=0; i<count; ++i) {
-			output[i] = std::move(q.front());
-			q.pop_front();
+		size_t n = std::min(count, max);
+		for (size_t i=0; i<n; ++i) {
+			output[i] = _pop_front();
 		}
 
-		return count;
+		return n;
 	}
 
 	// dequeue all elements (including none); never waits
@@ -162,34 +304,92 @@ public:
 	size_t pop_all (std_vector<T>* output) {
 		LOCK_GUARD;
 
-		size_t count = q.size();
-		output->reserve(count);
+		size_t n = count;
+		output->reserve(n);
 
-		for (size_t i=0; i<count; ++i) {
-			output->emplace_back( std::move(q.front()) );
-			q.pop_front();
+		for (size_t i=0; i<n; ++i) {
+			output->emplace_back( _pop_front() );
 		}
 
-		return count;
+		return n;
 	}
 
+	enum PopResult { POP, SHUTDOWN, WAKE };
+
 	// wait to dequeue one element from the queue or until shutdown is set
 	// returns if element was popped or shutdown was set as enum
 	// can be called from multiple threads (multiple consumer)
-	enum { POP, SHUTDOWN } pop_or_shutdown_wait (T* out) {
+	PopResult pop_or_shutdown_wait (T* out) {
+		_spin([this] () { return visible_count.load(std::memory_order_acquire) > 0; });
+		UNIQUE_LOCK;
+
+		while(!shutdown_flag && count == 0) {
+			_wait_for_item(lock);
+		}
+		if (shutdown_flag)
+			return SHUTDOWN;
+
+		*out = _pop_front();
+		return POP;
+	}
+
+	// like pop_or_shutdown_wait, but also returns WAKE without popping once template callback 'bool wake ()' returns true
+	// wake is checked under the lock, whoever makes it return true has to call notify_waiters() afterwards
+	// with set_spin_count wake is also called without the lock while spinning, so it should only read atomics
+	// lets consumers wait on other work sources in addition to this queue
+	template <typename WAKE_PRED>
+	PopResult pop_or_wake_wait (T* out, WAKE_PRED wake) {
+		_spin([this, &wake] () { return visible_count.load(std::memory_order_acquire) > 0 || wake(); });
 		UNIQUE_LOCK;
 
-		while(!shutdown_flag && q.empty()) {
-			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		while(!shutdown_flag && count == 0) {
+			if (wake())
+				return WAKE;
+			_wait_for_item(lock);
 		}
 		if (shutdown_flag)
 			return SHUTDOWN;
 
-		*out = std::move(q.front());
-		q.pop_front();
+		*out = _pop_front();
 		return POP;
 	}
 
+	// wake all waiting consumers so they recheck their wake condition
+	void notify_waiters () {
+		{
+			// taking the lock makes sure that no waiter is between checking wake() and starting to wait
+			LOCK_GUARD;
+		}
+		c.notify_all();
+	}
+
+	// mark n popped items as done being processed, once all pushed items are done join() returns
+	// items removed via remove_if() or clear() count as done automatically
+	void task_done (size_t n=1) {
+		size_t prev = unfinished.fetch_sub(n, std::memory_order_acq_rel);
+		assert(prev >= n);
+		if (prev == n && n > 0) {
+			// taking the lock makes sure that join() is not between checking unfinished and starting to wait
+			{ LOCK_GUARD; }
+			done_c.notify_all();
+		}
+	}
+
+	// wait until every pushed item was popped and marked as done via task_done() (like python queue.join())
+	// lets producers wait for consumers to be idle without any other synchronization
+	void join () {
+		UNIQUE_LOCK;
+
+		while (unfinished.load(std::memory_order_acquire) > 0) {
+			done_c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		}
+	}
+
+	// number of pushed items that were not marked as done yet
+	size_t unfinished_count () {
+		return unfinished.load(std::memory_order_relaxed);
+	}
+
 	// set shutdown which all consumers can recieve via pop_or_shutdown
 	void shutdown () {
 		LOCK_GUARD;
@@ -201,57 +401,97 @@ public:
 		shutdown_flag = false;
 	}
 
-	// iterate queued items with template callback 'void func (T&)' in order from the oldest to the newest pushed
+	// number of queued items
+	size_t size () {
+		LOCK_GUARD;
+		return count;
+	}
+	// max number of queued items since construction or the last reset_high_water_mark()
+	size_t high_water_mark () {
+		LOCK_GUARD;
+		return high_water;
+	}
+	void reset_high_water_mark () {
+		LOCK_GUARD;
+		high_water = count;
+	}
+	// number of queued items in priority level prio
+	size_t size (int prio) {
+		LOCK_GUARD;
+		return q[prio].size();
+	}
+
+	// iterate queued items with template callback 'void func (T&)' in order from the oldest to the newest pushed (in the order they will be popped)
 	// elements are allowed to be changed
 	template <typename FOREACH>
 	void iterate_queue (FOREACH callback) {
 		LOCK_GUARD;
 
-		for (auto it=q.begin(); it!=q.end(); ++it) {
-			callback(*it);
+		for (auto& level : q) {
+			for (auto it=level.begin(); it!=level.end(); ++it) {
+				callback(*it);
+			}
 		}
 	}
 
-	// iterate queued items with template callback 'void func (T&)' in order from the newest to the oldest pushed
+	// iterate queued items with template callback 'void func (T&)' in order from the newest to the oldest pushed (in reverse order they will be popped)
 	// elements are allowed to be changed
 	template <typename FOREACH>
 	void iterate_queue_newest_first (FOREACH callback) { // front == next to be popped, back == most recently pushed
 		LOCK_GUARD;
 
-		for (auto it=q.rbegin(); it!=q.rend(); ++it) {
-			callback(*it);
+		for (auto level=q.rbegin(); level!=q.rend(); ++level) {
+			for (auto it=level->rbegin(); it!=level->rend(); ++it) {
+				callback(*it);
+			}
 		}
 	}
 
 	// remove items if template callback 'bool func (T&)' returns true
 	// useful to be able to cancel queued jobs in a threadpool
+	// returns the number of removed items
 	template <typename NEED_TO_CANCEL>
-	void remove_if (NEED_TO_CANCEL need_to_cancel) {
+	size_t remove_if (NEED_TO_CANCEL need_to_cancel) {
 		LOCK_GUARD;
 
-		for (auto it=q.begin(); it!=q.end();) {
-			if (need_to_cancel(*it)) {
-				it = q.erase(it);
-			} else {
-				++it;
+		size_t removed = 0;
+		for (auto& level : q) {
+			for (auto it=level.begin(); it!=level.end();) {
+				if (need_to_cancel(*it)) {
+					it = level.erase(it);
+					removed++;
+				} else {
+					++it;
+				}
 			}
 		}
+		count -= removed;
+		visible_count.store(count, std::memory_order_relaxed);
+		_finished(removed);
+		return removed;
 	}
 
 	void clear () {
 		LOCK_GUARD;
 
-		q.clear();
+		for (auto& level : q)
+			level.clear();
+		_finished(count);
+		count = 0;
+		visible_count.store(0, std::memory_order_relaxed);
 	}
 
+	// sorts each priority level separately
 	template <typename COMPARATOR>
 	void sort (COMPARATOR cmp) {
 		LOCK_GUARD;
 
-		std::sort(q.begin(), q.end(), cmp);
+		for (auto& level : q)
+			std::sort(level.begin(), level.end(), cmp);
 	}
 };
 
+#undef THREADSAFE_QUEUE_CPU_PAUSE
 #undef MUTEX				
 #undef CONDITION_VARIABLE
 #undef UNIQUE_LOCK		
@@ -18,4 +18,17 @@
 
 		uint64_t timestamp_freq = get_timestamp_freq();
 	}
+#else
+	#include <time.h>
+
+	namespace kiss {
+		// CLOCK_MONOTONIC is read via the vdso without a syscall, in nanoseconds
+		uint64_t get_timestamp () {
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+		}
+
+		uint64_t timestamp_freq = 1000000000ull;
+	}
 #endif
@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include "stdint.h"
+#include "assert.h"
+
+// based on "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli 2013)
+// https://fzn.fr/readings/ppopp13.pdf
+
+// Chase-Lev work stealing deque with fixed capacity
+// the owner thread push()es and pop()s at the bottom (LIFO), any other thread can steal() from the top (FIFO)
+// T has to be trivially copyable (usually a pointer), since items are read speculatively by stealers
+template <typename T>
+class WorkStealingDeque {
+	std::unique_ptr<std::atomic<T>[]>	buf;
+	int64_t								mask;
+
+	// on separate cache lines, since top is written by stealers and bottom by the owner
+	alignas(64) std::atomic<int64_t>	top = 0;
+	alignas(64) std::atomic<int64_t>	bottom = 0;
+
+public:
+	// capacity needs to be a power of two
+	WorkStealingDeque (int64_t capacity=256): buf{std::make_unique<std::atomic<T>[]>(capacity)}, mask{capacity-1} {
+		assert(capacity > 0 && (capacity & (capacity-1)) == 0);
+	}
+
+	int64_t capacity () const {
+		return mask + 1;
+	}
+	// approximate when called from other threads
+	int64_t size () const {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+
+	// owner only, returns false if the deque is full
+	bool push (T item) {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t > mask)
+			return false;
+
+		buf[b & mask].store(item, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// owner only, pop the most recently pushed item
+	bool pop (T* out) {
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b) { // empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		*out = buf[b & mask].load(std::memory_order_relaxed);
+		if (t == b) {
+			// last item, race against stealers for it
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// any thread, take the oldest item
+	// can fail spuriously when racing with other stealers or the owner
+	bool steal (T* out) {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+			return false;
+
+		T item = buf[t & mask].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false;
+
+		*out = item;
+		return true;
+	}
+};